@@ -0,0 +1,395 @@
+// Measures listing, find, extraction and creation on generated archives for each backend
+// results are printed as JSON, pass --quick for smaller archives
+// build: g++ -std=c++17 -O2 -Isrc bench/archive_bench.cpp src/microtar.cpp -o archive_bench
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "microtar.h"
+#include "vectorstream.h"
+
+// deterministic generator, the same archives are produced on every run
+class rng_t
+{
+private:
+	std::uint64_t state;
+
+public:
+	explicit rng_t(std::uint64_t seed) : state(seed) {}
+
+	std::uint64_t next()
+	{
+		// xorshift64*
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1Dull;
+	}
+
+	size_t range(size_t lo, size_t hi)
+	{
+		return lo + static_cast<size_t>(next() % (hi - lo + 1));
+	}
+};
+
+struct entry_t
+{
+	std::string name;
+	size_t size;
+};
+
+struct shape_t
+{
+	const char* name;
+	std::vector<entry_t> entries;
+};
+
+// many files of up to 1 KiB
+static shape_t tiny_files(size_t count)
+{
+	rng_t rng(1);
+	shape_t shape{ "tiny", {} };
+	for (size_t i = 0; i < count; i++)
+	{
+		shape.entries.push_back({ "files/file_" + std::to_string(i) + ".txt", rng.range(0, 1024) });
+	}
+	return shape;
+}
+
+// few files of many MiB
+static shape_t huge_files(size_t count, size_t size)
+{
+	rng_t rng(2);
+	shape_t shape{ "huge", {} };
+	for (size_t i = 0; i < count; i++)
+	{
+		shape.entries.push_back({ "blob_" + std::to_string(i) + ".bin", size - rng.range(0, 4096) });
+	}
+	return shape;
+}
+
+// long paths, some of them longer than the ustar name field
+static shape_t deep_paths(size_t count)
+{
+	rng_t rng(3);
+	shape_t shape{ "deep", {} };
+	for (size_t i = 0; i < count; i++)
+	{
+		std::string name;
+		const size_t depth = rng.range(4, 16);
+		for (size_t d = 0; d < depth; d++)
+		{
+			name += "directory_" + std::to_string(rng.range(0, 9)) + "/";
+		}
+		name += "file_" + std::to_string(i);
+		shape.entries.push_back({ name, rng.range(0, 4096) });
+	}
+	return shape;
+}
+
+// mostly small files with some large ones
+static shape_t mixed_files(size_t count)
+{
+	rng_t rng(4);
+	shape_t shape{ "mixed", {} };
+	for (size_t i = 0; i < count; i++)
+	{
+		const size_t size = rng.range(0, 15) == 0 ? rng.range(64 << 10, 4 << 20) : rng.range(0, 16 << 10);
+		shape.entries.push_back({ "mixed/" + std::to_string(i % 32) + "/entry_" + std::to_string(i), size });
+	}
+	return shape;
+}
+
+// archive storage and mtar_t construction for one kind of backend
+class backend_t
+{
+public:
+	virtual ~backend_t() = default;
+	virtual const char* name() const = 0;
+	// empty archive for writing
+	virtual std::unique_ptr<mtar_t> create() = 0;
+	// archive with the given contents for reading
+	virtual std::unique_ptr<mtar_t> open(const std::string& archive) = 0;
+};
+
+class stream_backend_t : public backend_t
+{
+private:
+	std::stringstream ss;
+
+public:
+	const char* name() const override { return "stream"; }
+	std::unique_ptr<mtar_t> create() override
+	{
+		ss = std::stringstream();
+		return std::make_unique<mtar_t>(static_cast<std::ostream&>(ss));
+	}
+	std::unique_ptr<mtar_t> open(const std::string& archive) override
+	{
+		ss = std::stringstream(archive);
+		return std::make_unique<mtar_t>(static_cast<std::istream&>(ss));
+	}
+};
+
+class vectorstream_backend_t : public backend_t
+{
+private:
+	std::unique_ptr<mtar::vectorstream> vs;
+
+public:
+	const char* name() const override { return "vectorstream"; }
+	std::unique_ptr<mtar_t> create() override
+	{
+		vs = std::make_unique<mtar::vectorstream>();
+		return std::make_unique<mtar_t>(*vs);
+	}
+	std::unique_ptr<mtar_t> open(const std::string& archive) override
+	{
+		vs = std::make_unique<mtar::vectorstream>(archive.begin(), archive.end());
+		return std::make_unique<mtar_t>(*vs);
+	}
+};
+
+class custom_backend_t : public backend_t
+{
+private:
+	std::string data;
+	size_t pos = 0;
+
+public:
+	const char* name() const override { return "custom"; }
+	std::unique_ptr<mtar_t> create() override
+	{
+		data.clear();
+		return std::make_unique<mtar_t>(nullptr,
+			[this](mtar_t&, const char* p, size_t n)
+			{
+				data.append(p, n);
+				return mtar_error::SUCCESS;
+			},
+			nullptr, [](mtar_t&) {});
+	}
+	std::unique_ptr<mtar_t> open(const std::string& archive) override
+	{
+		data = archive;
+		pos = 0;
+		return std::make_unique<mtar_t>(
+			[this](mtar_t&, char* p, size_t n)
+			{
+				if (data.size() - pos < n)
+				{
+					return mtar_error::READFAIL;
+				}
+				std::memcpy(p, data.data() + pos, n);
+				pos += n;
+				return mtar_error::SUCCESS;
+			},
+			nullptr,
+			[this](mtar_t&, mtar_size_t p)
+			{
+				if (p > data.size())
+				{
+					return mtar_error::SEEKFAIL;
+				}
+				pos = static_cast<size_t>(p);
+				return mtar_error::SUCCESS;
+			},
+			[](mtar_t&) {});
+	}
+};
+
+// best time of several runs, in seconds
+// setup (loading the archive into the backend) is not timed
+static double best_of(size_t runs, const std::function<std::unique_ptr<mtar_t>()>& setup,
+	const std::function<void(mtar_t&)>& f)
+{
+	double best = 1e300;
+	for (size_t i = 0; i < runs; i++)
+	{
+		std::unique_ptr<mtar_t> tar = setup();
+		const auto start = std::chrono::steady_clock::now();
+		f(*tar);
+		tar.reset(); // flushes buffered writes
+		const auto end = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(end - start).count());
+	}
+	return best;
+}
+
+static void check(mtar_error err, const char* what)
+{
+	if (err != mtar_error::SUCCESS)
+	{
+		std::fprintf(stderr, "%s: %s\n", what, mtar_t::strerror(err).data());
+		std::exit(1);
+	}
+}
+
+static void write_archive(mtar_t& tar, const shape_t& shape, const std::string& payload)
+{
+	for (const entry_t& e : shape.entries)
+	{
+		check(tar.write_file_header(e.name, e.size), "write_file_header");
+		if (e.size != 0)
+		{
+			check(tar.write_data(payload.data(), e.size), "write_data");
+		}
+	}
+	check(tar.finalize(), "finalize");
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+	const size_t scale = quick ? 1 : 10;
+	const size_t runs = quick ? 1 : 3;
+
+	std::vector<shape_t> shapes;
+	shapes.push_back(tiny_files(2000 * scale));
+	shapes.push_back(huge_files(4, (quick ? 4 : 32) << 20));
+	shapes.push_back(deep_paths(1000 * scale));
+	shapes.push_back(mixed_files(200 * scale));
+
+	/* Data of every entry is a prefix of the payload */
+	size_t max_size = 0;
+	for (const shape_t& shape : shapes)
+	{
+		for (const entry_t& e : shape.entries)
+		{
+			max_size = std::max(max_size, e.size);
+		}
+	}
+	std::string payload(max_size, '\0');
+	rng_t rng(5);
+	for (char& c : payload)
+	{
+		c = static_cast<char>('a' + rng.range(0, 25));
+	}
+
+	std::vector<std::unique_ptr<backend_t>> backends;
+	backends.push_back(std::make_unique<stream_backend_t>());
+	backends.push_back(std::make_unique<vectorstream_backend_t>());
+	backends.push_back(std::make_unique<custom_backend_t>());
+
+	std::printf("{\n  \"version\": \"%s\",\n  \"quick\": %s,\n  \"results\": [", MTAR_VERSION, quick ? "true" : "false");
+	bool first = true;
+	for (const shape_t& shape : shapes)
+	{
+		/* Reference archive for the read benchmarks */
+		std::ostringstream os;
+		{
+			mtar_t tar(static_cast<std::ostream&>(os));
+			write_archive(tar, shape, payload);
+		}
+		const std::string archive = os.str();
+		size_t data_bytes = 0;
+		for (const entry_t& e : shape.entries)
+		{
+			data_bytes += e.size;
+		}
+
+		/* Names to find, spread over the archive */
+		constexpr size_t find_count = 16;
+		std::vector<std::string> find_names;
+		rng_t pick(6);
+		for (size_t i = 0; i < find_count; i++)
+		{
+			find_names.push_back(shape.entries[pick.range(0, shape.entries.size() - 1)].name);
+		}
+
+		for (const auto& backend : backends)
+		{
+			auto create = [&] { return backend->create(); };
+			auto open = [&] { return backend->open(archive); };
+
+			/* Every entry must read back as written before anything is timed */
+			{
+				std::unique_ptr<mtar_t> tar = open();
+				std::string data;
+				size_t i = 0;
+				for (mtar_entry_t& e : tar->entries())
+				{
+					data.resize(static_cast<size_t>(e.remaining()));
+					if (i >= shape.entries.size() || e.header().name() != shape.entries[i].name ||
+						data.size() != shape.entries[i].size ||
+						(!data.empty() && e.read(data.data(), data.size()) != mtar_error::SUCCESS) ||
+						data.compare(0, data.size(), payload, 0, data.size()) != 0)
+					{
+						check(mtar_error::FAILURE, "read back");
+					}
+					i++;
+				}
+				if (i != shape.entries.size())
+				{
+					check(mtar_error::FAILURE, "read back");
+				}
+			}
+
+			const double create_s = best_of(runs, create, [&](mtar_t& tar)
+			{
+				write_archive(tar, shape, payload);
+			});
+
+			const double list_s = best_of(runs, open, [&](mtar_t& tar)
+			{
+				mtar_header_view_t h;
+				size_t n = 0;
+				while (tar.read_header(h) == mtar_error::SUCCESS)
+				{
+					n++;
+					tar.next();
+				}
+				if (n != shape.entries.size())
+				{
+					check(mtar_error::FAILURE, "list");
+				}
+			});
+
+			const double find_s = best_of(runs, open, [&](mtar_t& tar)
+			{
+				mtar_header_t h;
+				for (const std::string& name : find_names)
+				{
+					check(tar.find(name, h), "find");
+				}
+			});
+
+			std::vector<char> buf(1 << 20);
+			const double extract_s = best_of(runs, open, [&](mtar_t& tar)
+			{
+				size_t bytes = 0;
+				for (mtar_entry_t& e : tar.entries())
+				{
+					while (e.remaining() > 0)
+					{
+						const size_t n = static_cast<size_t>(std::min<mtar_size_t>(e.remaining(), buf.size()));
+						check(e.read(buf.data(), n), "read");
+						bytes += n;
+					}
+				}
+				if (bytes != data_bytes)
+				{
+					check(mtar_error::FAILURE, "extract");
+				}
+			});
+
+			const double mb = static_cast<double>(archive.size()) / (1 << 20);
+			std::printf("%s\n    {\"shape\": \"%s\", \"backend\": \"%s\", \"entries\": %zu, \"archive_bytes\": %zu, "
+				"\"list_headers_per_s\": %.0f, \"find_us\": %.2f, \"extract_mb_per_s\": %.1f, \"create_mb_per_s\": %.1f}",
+				first ? "" : ",", shape.name, backend->name(), shape.entries.size(), archive.size(),
+				static_cast<double>(shape.entries.size()) / list_s, find_s / find_count * 1e6,
+				mb / extract_s, mb / create_s);
+			first = false;
+		}
+	}
+	std::printf("\n  ]\n}\n");
+	return 0;
+}
@@ -0,0 +1,80 @@
+// Compares mtar_t::checksum against the original scalar loop
+// build: g++ -std=c++17 -O2 -Isrc bench/checksum_bench.cpp src/microtar.cpp -o checksum_bench
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include "microtar.h"
+
+// checksum as it was before SIMD kernels were added
+static unsigned int checksum_loop(const char* rh)
+{
+	unsigned res = 8 * 32;
+	for (size_t i = 0; i < 148; i++)
+	{
+		res += static_cast<unsigned char>(rh[i]);
+	}
+	for (size_t i = 156; i < 512; i++)
+	{
+		res += static_cast<unsigned char>(rh[i]);
+	}
+	return res;
+}
+
+template<typename F>
+static double time_ns(F&& f, size_t iterations)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++)
+	{
+		f();
+	}
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+int main()
+{
+	/* Build headers for many small files */
+	constexpr size_t count = 4096;
+	std::ostringstream os;
+	{
+		mtar_t tar(static_cast<std::ostream&>(os));
+		for (size_t i = 0; i < count; i++)
+		{
+			tar.write_file_header("some/directory/file_" + std::to_string(i) + ".txt", 0);
+		}
+	}
+	const std::string archive = os.str();
+	const char* data = archive.data();
+
+	constexpr size_t rounds = 200;
+	volatile unsigned int sink = 0;
+	const double loop_ns = time_ns([&]
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			sink = sink + checksum_loop(data + i * 512);
+		}
+	}, rounds);
+	const double simd_ns = time_ns([&]
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			sink = sink + mtar_t::checksum(data + i * 512);
+		}
+	}, rounds);
+	std::vector<mtar_error> results(count);
+	const double batch_ns = time_ns([&]
+	{
+		sink = sink + static_cast<unsigned int>(mtar_t::validate_headers(data, count, results.data()));
+	}, rounds);
+
+	const double n = static_cast<double>(count * rounds);
+	std::printf("loop:     %6.2f ns/header\n", loop_ns / n);
+	std::printf("checksum: %6.2f ns/header (%.2fx)\n", simd_ns / n, loop_ns / simd_ns);
+	std::printf("validate: %6.2f ns/header\n", batch_ns / n);
+	return 0;
+}
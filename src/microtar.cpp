@@ -21,10 +21,32 @@
  */
 
 #include <algorithm>
-#include <charconv>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "microtar.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#ifdef MTAR_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 namespace mtar_raw_header_info
 {
 	constexpr size_t name_offset = 0;
@@ -53,446 +75,3669 @@ constexpr size_t mtar_raw_header_size = mtar_raw_header_info::_padding_offset +
 constexpr size_t mtar_record_size = 512;
 static_assert(mtar_raw_header_size == mtar_record_size);
 
-size_t mtar_t::round_up(size_t n, size_t incr)
+/* On-disk index layout, all integers are little endian
+ * header (56 bytes):
+ *   magic[8] "MTARIDX\0", version u32, reserved u32,
+ *   entry count u64, name storage size u64, end offset u64, digest u64, archive size u64 (0 if unknown)
+ * entries (40 bytes each, archive order):
+ *   header offset u64, data offset u64, size u64, name offset u64, name size u32, type u8, reserved[3]
+ * name storage */
+namespace
+{
+	namespace mtar_index_info
+	{
+		constexpr char magic[8] = { 'M', 'T', 'A', 'R', 'I', 'D', 'X', '\0' };
+		constexpr std::uint32_t version = 3;
+		constexpr size_t header_size = 56;
+		// headers compared by a quick validate, spread evenly over the archive
+		constexpr size_t validate_samples = 8;
+		constexpr size_t entry_size = 40;
+
+		void put_u64(char* p, std::uint64_t v)
+		{
+			for (size_t i = 0; i < 8; i++)
+			{
+				p[i] = static_cast<char>(v >> (i * 8));
+			}
+		}
+
+		std::uint64_t get_u64(const char* p)
+		{
+			std::uint64_t v = 0;
+			for (size_t i = 0; i < 8; i++)
+			{
+				v |= static_cast<std::uint64_t>(static_cast<unsigned char>(p[i])) << (i * 8);
+			}
+			return v;
+		}
+
+		// hash (FNV-1a) of the position, size, type, name and ustar checksum of an entry
+		// the checksum covers the other ustar fields, so any change to a header changes the hash
+		// the index digest is the sum over all entries, so entries can be updated one at a time
+		std::uint64_t entry_digest(const mtar_index_entry_t& e, std::string_view name, const char* rh)
+		{
+			using namespace mtar_raw_header_info;
+			std::uint64_t d = 0xCBF29CE484222325ull;
+			char buf[8 * 3 + 1];
+			put_u64(buf, e.header_offset);
+			put_u64(buf + 8, e.data_offset);
+			put_u64(buf + 16, e.size);
+			buf[24] = static_cast<char>(e.type);
+			auto add = [&d](const char* p, size_t n)
+			{
+				for (size_t i = 0; i < n; i++)
+				{
+					d = (d ^ static_cast<unsigned char>(p[i])) * 0x100000001B3ull;
+				}
+			};
+			add(buf, sizeof(buf));
+			add(name.data(), name.size());
+			add(rh + checksum_offset, checksum_size);
+			return d;
+		}
+	};
+}
+
+/* Fixed width numeric fields
+ * octal digits are converted 8 at a time using SWAR (SIMD within a register)
+ * fields may start with spaces and end with a space or null, and GNU base-256
+ * (first byte has the high bit set) is used for values that don't fit in octal */
+namespace
+{
+	namespace mtar_octal
+	{
+		constexpr std::uint64_t ones = 0x0101010101010101;
+		constexpr std::uint64_t zeros = ones * '0';
+
+		// load 8 bytes, first byte in lowest bits
+		std::uint64_t load_le(const char* p)
+		{
+			std::uint64_t v = 0;
+			for (size_t i = 0; i < 8; i++)
+			{
+				v |= static_cast<std::uint64_t>(static_cast<unsigned char>(p[i])) << (i * 8);
+			}
+			return v;
+		}
+
+		void store_le(char* p, std::uint64_t v)
+		{
+			for (size_t i = 0; i < 8; i++)
+			{
+				p[i] = static_cast<char>(v >> (i * 8));
+			}
+		}
+
+		// number of leading octal digits in 8 bytes
+		size_t count_digits(std::uint64_t x)
+		{
+			// bytes '0'-'7' become 0, any other byte is nonzero
+			const std::uint64_t t = (x & (ones * 0xF8)) ^ zeros;
+			// high bit of each nonzero byte
+			const std::uint64_t m = (((t & (ones * 0x7F)) + ones * 0x7F) | t) & (ones * 0x80);
+			if (m == 0)
+			{
+				return 8;
+			}
+			size_t n = 0;
+			while (((m >> (n * 8)) & 0x80) == 0)
+			{
+				n++;
+			}
+			return n;
+		}
+
+		// value of the first n (<= 8) octal digits in x
+		std::uint64_t digits_value(std::uint64_t x, size_t n)
+		{
+			if (n == 0)
+			{
+				return 0;
+			}
+			if (n < 8)
+			{
+				// right align digits, filling with leading zeros
+				x = (x << (8 * (8 - n))) | (zeros >> (8 * n));
+			}
+			x -= zeros;
+			// combine neighbours: bytes -> 6 bit in 16 bit lanes -> 12 bit in 32 bit lanes -> 24 bit
+			x = ((x << 3) + (x >> 8)) & 0x003F003F003F003F;
+			x = ((x << 6) + (x >> 16)) & 0x00000FFF00000FFF;
+			x = ((x << 12) + (x >> 32)) & 0xFFFFFF;
+			return x;
+		}
+
+		// 8 octal digits of v (< 8^8), most significant first
+		std::uint64_t digits_of(std::uint64_t v)
+		{
+			// spread 3 bit groups into bytes, least significant digit in lowest byte
+			v = (v | (v << 20)) & 0x00000FFF00000FFF;
+			v = (v | (v << 10)) & 0x003F003F003F003F;
+			v = (v | (v << 5)) & 0x0707070707070707;
+			// reverse so most significant digit comes first
+			std::uint64_t r = 0;
+			for (size_t i = 0; i < 8; i++)
+			{
+				r = (r << 8) | ((v >> (i * 8)) & 0xFF);
+			}
+			return r + zeros;
+		}
+
+		// decode field of width <= 12
+		bool decode(const char* p, size_t width, std::uint64_t& v)
+		{
+			/* Base-256, only positive values are supported */
+			if (static_cast<unsigned char>(p[0]) & 0x80)
+			{
+				if (static_cast<unsigned char>(p[0]) & 0x40)
+				{
+					return false;
+				}
+				v = static_cast<unsigned char>(p[0]) & 0x3F;
+				for (size_t i = 1; i < width; i++)
+				{
+					if (v >> 56)
+					{
+						return false;
+					}
+					v = (v << 8) | static_cast<unsigned char>(p[i]);
+				}
+				return true;
+			}
+			/* Octal, copy so 8 byte loads never leave the field */
+			char buf[24]{};
+			std::copy_n(p, width, buf);
+			size_t start = 0;
+			while (start < width && buf[start] == ' ')
+			{
+				start++;
+			}
+			const std::uint64_t x0 = load_le(buf + start);
+			size_t n = std::min(count_digits(x0), width - start);
+			if (n < 8)
+			{
+				v = digits_value(x0, n);
+			}
+			else
+			{
+				const std::uint64_t x1 = load_le(buf + start + 8);
+				const size_t n1 = std::min(count_digits(x1), width - start - 8);
+				v = (digits_value(x0, 8) << (3 * n1)) | digits_value(x1, n1);
+				n += n1;
+			}
+			/* Digits must be followed by a terminator or the end of the field */
+			const size_t end = start + n;
+			return end == width || buf[end] == ' ' || buf[end] == '\0';
+		}
+
+		// encode field of width <= 12 as width - 1 octal digits followed by a null
+		// values that don't fit are encoded as base-256 using all of the field
+		bool encode(char* p, size_t width, std::uint64_t v)
+		{
+			const size_t digits = width - 1;
+			if (digits * 3 >= 64 || v >> (digits * 3) == 0)
+			{
+				char buf[16];
+				store_le(buf, digits_of(v >> 24));
+				store_le(buf + 8, digits_of(v & 0xFFFFFF));
+				std::copy_n(buf + 16 - digits, digits, p);
+				p[digits] = '\0';
+				return true;
+			}
+			if ((width - 1) * 8 < 64 && v >> ((width - 1) * 8) != 0)
+			{
+				return false;
+			}
+			p[0] = static_cast<char>(0x80);
+			for (size_t i = width - 1; i > 0; i--)
+			{
+				p[i] = static_cast<char>(v & 0xFF);
+				v >>= 8;
+			}
+			return true;
+		}
+
+		// decode field into smaller integer type
+		template<typename T>
+		bool decode(const char* p, size_t width, T& v)
+		{
+			std::uint64_t u;
+			if (!decode(p, width, u) || u > std::numeric_limits<T>::max())
+			{
+				return false;
+			}
+			v = static_cast<T>(u);
+			return true;
+		}
+	};
+}
+
+/* Pax extended headers
+ * data is a sequence of "<length> <keyword>=<value>\n" records, where length
+ * counts the whole record including itself */
+namespace
+{
+	namespace mtar_pax
+	{
+		// values overriding the following ustar header
+		struct overrides_t
+		{
+			bool has_size = false;
+			mtar_size_t size = 0;
+			bool has_path = false;
+			std::string path;
+			bool has_linkpath = false;
+			std::string linkpath;
+		};
+
+		bool parse(std::string_view data, overrides_t& o)
+		{
+			while (!data.empty())
+			{
+				/* Record length */
+				size_t len = 0;
+				size_t i = 0;
+				while (i < data.size() && data[i] >= '0' && data[i] <= '9')
+				{
+					len = len * 10 + (data[i] - '0');
+					i++;
+				}
+				if (i == 0 || i >= data.size() || data[i] != ' ' || len <= i + 1 || len > data.size() || data[len - 1] != '\n')
+				{
+					return false;
+				}
+				/* Keyword and value */
+				const std::string_view record = data.substr(i + 1, len - i - 2);
+				const size_t eq = record.find('=');
+				if (eq == std::string_view::npos)
+				{
+					return false;
+				}
+				const std::string_view key = record.substr(0, eq);
+				const std::string_view value = record.substr(eq + 1);
+				if (key == "size")
+				{
+					o.size = 0;
+					for (char c : value)
+					{
+						if (c < '0' || c > '9')
+						{
+							return false;
+						}
+						o.size = o.size * 10 + (c - '0');
+					}
+					o.has_size = true;
+				}
+				else if (key == "path")
+				{
+					o.path = value;
+					o.has_path = true;
+				}
+				else if (key == "linkpath")
+				{
+					o.linkpath = value;
+					o.has_linkpath = true;
+				}
+				data.remove_prefix(len);
+			}
+			return true;
+		}
+
+		void append_record(std::string& out, std::string_view key, std::string_view value)
+		{
+			// length includes its own digits, which may need one more digit once added
+			const size_t base = key.size() + value.size() + 3; // space, '=', newline
+			size_t len = base + 1;
+			while (len != base + std::to_string(len).size())
+			{
+				len = base + std::to_string(len).size();
+			}
+			out += std::to_string(len);
+			out += ' ';
+			out += key;
+			out += '=';
+			out += value;
+			out += '\n';
+		}
+	};
+}
+
+mtar_size_t mtar_t::round_up(mtar_size_t n, mtar_size_t incr)
 {
 	return n + (incr - n % incr) % incr;
 }
 
-unsigned int mtar_t::checksum(const mtar_raw_header_t& rh)
+/* Checksum kernels
+ * all of them sum the whole record and then remove the checksum field, which
+ * is counted as 8 spaces instead */
+namespace
+{
+	namespace mtar_checksum
+	{
+		using namespace mtar_raw_header_info;
+
+		unsigned int field_sum(const char* rh)
+		{
+			unsigned int res = 0;
+			for (size_t i = checksum_offset; i < checksum_offset + checksum_size; i++)
+			{
+				res += static_cast<unsigned char>(rh[i]);
+			}
+			return res;
+		}
+
+#if defined(__SSE2__) || defined(_M_X64)
+		unsigned int sse2(const char* rh)
+		{
+			// sad against zero sums each group of 8 bytes into a 64 bit lane
+			const __m128i zero = _mm_setzero_si128();
+			__m128i acc = zero;
+			for (size_t i = 0; i < mtar_raw_header_size; i += 16)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rh + i));
+				acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+			}
+			const unsigned int res = static_cast<unsigned int>(_mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4));
+			return res - field_sum(rh) + 8 * ' ';
+		}
+#else
+		unsigned int scalar(const char* rh)
+		{
+			unsigned int res = 0;
+			for (size_t i = 0; i < mtar_raw_header_size; i++)
+			{
+				res += static_cast<unsigned char>(rh[i]);
+			}
+			return res - field_sum(rh) + 8 * ' ';
+		}
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MTAR_CHECKSUM_AVX2 1
+		__attribute__((target("avx2"))) unsigned int avx2(const char* rh)
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			__m256i acc = zero;
+			for (size_t i = 0; i < mtar_raw_header_size; i += 32)
+			{
+				const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rh + i));
+				acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+			}
+			const __m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+			const unsigned int res = static_cast<unsigned int>(_mm_cvtsi128_si32(acc128) + _mm_extract_epi16(acc128, 4));
+			return res - field_sum(rh) + 8 * ' ';
+		}
+
+		// four headers at once, their sums are reduced together
+		__attribute__((target("avx2"))) void avx2_batch(const char* data, size_t count, unsigned int* sums)
+		{
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				const char* rh = data + i * mtar_raw_header_size;
+				const __m256i zero = _mm256_setzero_si256();
+				__m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+				for (size_t j = 0; j < mtar_raw_header_size; j += 32)
+				{
+					acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rh + j)), zero));
+					acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rh + mtar_raw_header_size + j)), zero));
+					acc2 = _mm256_add_epi64(acc2, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rh + 2 * mtar_raw_header_size + j)), zero));
+					acc3 = _mm256_add_epi64(acc3, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rh + 3 * mtar_raw_header_size + j)), zero));
+				}
+				// lane sums fit in 32 bits, so two headers share each 64 bit lane
+				const __m256i acc01 = _mm256_or_si256(acc0, _mm256_slli_epi64(acc1, 32));
+				const __m256i acc23 = _mm256_or_si256(acc2, _mm256_slli_epi64(acc3, 32));
+				const __m256i sum01 = _mm256_add_epi32(acc01, _mm256_shuffle_epi32(acc01, _MM_SHUFFLE(1, 0, 3, 2)));
+				const __m256i sum23 = _mm256_add_epi32(acc23, _mm256_shuffle_epi32(acc23, _MM_SHUFFLE(1, 0, 3, 2)));
+				const __m256i sums0123 = _mm256_unpacklo_epi64(sum01, sum23);
+				const __m128i res = _mm_add_epi32(_mm256_castsi256_si128(sums0123), _mm256_extracti128_si256(sums0123, 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i), res);
+				for (size_t k = 0; k < 4; k++)
+				{
+					sums[i + k] = sums[i + k] - field_sum(rh + k * mtar_raw_header_size) + 8 * ' ';
+				}
+			}
+			for (; i < count; i++)
+			{
+				sums[i] = avx2(data + i * mtar_raw_header_size);
+			}
+		}
+#endif
+
+		using kernel = unsigned int(*)(const char*);
+
+		kernel select()
+		{
+#ifdef MTAR_CHECKSUM_AVX2
+			// may run before the runtime initialized the cpu model, e.g. from another static initializer
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+			{
+				return avx2;
+			}
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+			return sse2;
+#else
+			return scalar;
+#endif
+		}
+
+		// chosen on first use, so it is set even when called during static initialization
+		kernel impl()
+		{
+			static const kernel k = select();
+			return k;
+		}
+
+		using batch_kernel = void(*)(const char*, size_t, unsigned int*);
+
+		void single_batch(const char* data, size_t count, unsigned int* sums)
+		{
+			const kernel k = impl();
+			for (size_t i = 0; i < count; i++)
+			{
+				sums[i] = k(data + i * mtar_raw_header_size);
+			}
+		}
+
+		batch_kernel select_batch()
+		{
+#ifdef MTAR_CHECKSUM_AVX2
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+			{
+				return avx2_batch;
+			}
+#endif
+			return single_batch;
+		}
+
+		batch_kernel batch_impl()
+		{
+			static const batch_kernel k = select_batch();
+			return k;
+		}
+
+		// compare sum with the checksum field of rh
+		mtar_error compare(const char* rh, unsigned int sum)
+		{
+			/* If the checksum starts with a null byte we assume the record is NULL */
+			if (rh[checksum_offset] == '\0')
+			{
+				return mtar_error::NULLRECORD;
+			}
+			unsigned int stored;
+			if (!mtar_octal::decode(rh + checksum_offset, checksum_size, stored) || sum != stored)
+			{
+				return mtar_error::BADCHKSUM;
+			}
+			return mtar_error::SUCCESS;
+		}
+	};
+}
+
+unsigned int mtar_t::checksum(const char* rh)
+{
+	return mtar_checksum::impl()(rh);
+}
+
+mtar_error mtar_t::check_header(const char* rh)
 {
 	using namespace mtar_raw_header_info;
-	unsigned i;
-	unsigned res = 8 * 32;
-	// skip checksum data while computing checksum
-	for (size_t i = 0; i < checksum_offset; i++)
+
+	/* Null record is checked before the checksum is built */
+	if (rh[checksum_offset] == '\0')
+	{
+		return mtar_error::NULLRECORD;
+	}
+	return mtar_checksum::compare(rh, checksum(rh));
+}
+
+size_t mtar_t::validate_headers(const char* data, size_t count, mtar_error* results)
+{
+	/* Sum a block of headers with the batch kernel, then compare each with its field */
+	constexpr size_t block = 64;
+	std::array<unsigned int, block> sums;
+	size_t valid = 0;
+	for (size_t first = 0; first < count; first += block)
+	{
+		const size_t n = std::min(block, count - first);
+		const char* rh = data + first * mtar_raw_header_size;
+		mtar_checksum::batch_impl()(rh, n, sums.data());
+		for (size_t i = 0; i < n; i++)
+		{
+			results[first + i] = mtar_checksum::compare(rh + i * mtar_raw_header_size, sums[i]);
+			if (results[first + i] == mtar_error::SUCCESS)
+			{
+				valid++;
+			}
+		}
+	}
+	return valid;
+}
+
+#ifdef MTAR_POSIX
+/* File descriptor I/O, retrying on short transfers and interrupts
+ * pos is ignored unless positional is set */
+namespace
+{
+	namespace mtar_fd
+	{
+		mtar_error read(int fd, bool positional, mtar_size_t pos, char* data, size_t size)
+		{
+			while (size > 0)
+			{
+				const ssize_t n = positional ? ::pread(fd, data, size, static_cast<off_t>(pos)) : ::read(fd, data, size);
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (n <= 0)
+				{
+					return mtar_error::READFAIL;
+				}
+				data += n;
+				size -= n;
+				pos += n;
+			}
+			return mtar_error::SUCCESS;
+		}
+
+		mtar_error writev(int fd, bool positional, mtar_size_t pos, iovec* iov, int count)
+		{
+			while (count > 0)
+			{
+				const ssize_t n = positional ? ::pwritev(fd, iov, count, static_cast<off_t>(pos)) : ::writev(fd, iov, count);
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (n < 0)
+				{
+					return mtar_error::WRITEFAIL;
+				}
+				pos += n;
+				/* Drop buffers that were written completely */
+				size_t done = static_cast<size_t>(n);
+				while (count > 0 && done >= iov->iov_len)
+				{
+					done -= iov->iov_len;
+					iov++;
+					count--;
+				}
+				if (count > 0)
+				{
+					iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+					iov->iov_len -= done;
+				}
+			}
+			return mtar_error::SUCCESS;
+		}
+
+		mtar_error write(int fd, bool positional, mtar_size_t pos, const char* data, size_t size)
+		{
+			iovec iov{ const_cast<char*>(data), size };
+			return writev(fd, positional, pos, &iov, 1);
+		}
+
+		/* Copy between descriptors, in the kernel if possible
+		 * in is read at *in_pos if given (which is advanced), otherwise at its offset
+		 * out is written at out_pos if out_positional, otherwise at its offset
+		 * each method is tried until one is supported for this pair of descriptors */
+		mtar_error copy(int in, mtar_size_t* in_pos, int out, bool out_positional, mtar_size_t out_pos,
+			mtar_size_t size, std::vector<char>& buf)
+		{
+			enum class method_t
+			{
+				COPY_FILE_RANGE,
+				SENDFILE,
+				SPLICE,
+				BUFFERED
+			};
+#ifdef __linux__
+			method_t method = method_t::COPY_FILE_RANGE;
+#else
+			method_t method = method_t::BUFFERED;
+#endif
+			constexpr size_t chunk_size = 1 << 30;
+			while (size > 0)
+			{
+				const size_t n = static_cast<size_t>(std::min<mtar_size_t>(size, chunk_size));
+				ssize_t done = -1;
+#ifdef __linux__
+				loff_t off_in = in_pos != nullptr ? static_cast<loff_t>(*in_pos) : 0;
+				loff_t off_out = static_cast<loff_t>(out_pos);
+				switch (method)
+				{
+				case method_t::COPY_FILE_RANGE:
+					done = ::copy_file_range(in, in_pos != nullptr ? &off_in : nullptr,
+						out, out_positional ? &off_out : nullptr, n, 0);
+					break;
+				case method_t::SENDFILE:
+					// writes at the offset of out, which is not used by positional I/O
+					if (out_positional && ::lseek(out, static_cast<off_t>(out_pos), SEEK_SET) < 0)
+					{
+						return mtar_error::SEEKFAIL;
+					}
+					done = ::sendfile(out, in, in_pos != nullptr ? &off_in : nullptr, n);
+					break;
+				case method_t::SPLICE:
+					// needs a pipe on one side
+					done = ::splice(in, in_pos != nullptr ? &off_in : nullptr,
+						out, out_positional ? &off_out : nullptr, n, 0);
+					break;
+				default:
+					break;
+				}
+#endif
+				if (method == method_t::BUFFERED)
+				{
+					if (buf.empty())
+					{
+						buf.resize(1 << 18);
+					}
+					const size_t m = std::min(n, buf.size());
+					mtar_error err = read(in, in_pos != nullptr, in_pos != nullptr ? *in_pos : 0, buf.data(), m);
+					if (err != mtar_error::SUCCESS)
+					{
+						return err;
+					}
+					err = write(out, out_positional, out_pos, buf.data(), m);
+					if (err != mtar_error::SUCCESS)
+					{
+						return err;
+					}
+					done = static_cast<ssize_t>(m);
+				}
+				if (done < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					/* Not supported for these descriptors, try the next method */
+					if (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP ||
+						errno == EBADF || errno == ESPIPE || errno == ETXTBSY)
+					{
+						method = static_cast<method_t>(static_cast<int>(method) + 1);
+						continue;
+					}
+					return mtar_error::WRITEFAIL;
+				}
+				if (done == 0)
+				{
+					// source ended early
+					return mtar_error::READFAIL;
+				}
+				if (in_pos != nullptr)
+				{
+					*in_pos += done;
+				}
+				out_pos += done;
+				size -= done;
+			}
+			return mtar_error::SUCCESS;
+		}
+	};
+}
+#endif
+
+void mtar_histogram_t::add(std::uint64_t ns)
+{
+	size_t bucket = 0;
+	while (bucket + 1 < buckets && ns >> (bucket + 1) != 0)
+	{
+		bucket++;
+	}
+	counts[bucket]++;
+	count++;
+	total_ns += ns;
+}
+
+std::uint64_t mtar_histogram_t::percentile(double p) const
+{
+	const double target = p * static_cast<double>(count);
+	std::uint64_t seen = 0;
+	for (size_t i = 0; i < buckets; i++)
+	{
+		seen += counts[i];
+		if (seen != 0 && static_cast<double>(seen) >= target)
+		{
+			return (std::uint64_t(2) << i) - 1;
+		}
+	}
+	return 0;
+}
+
+template<typename F>
+mtar_error mtar_t::instrument(mtar_io_kind kind, mtar_size_t pos, size_t size, F&& f)
+{
+#ifdef MTAR_NO_STATS
+	(void)kind;
+	(void)pos;
+	(void)size;
+	return f();
+#else
+	mtar_histogram_t* latency;
+	switch (kind)
+	{
+	case mtar_io_kind::READ:
+		stats.reads++;
+		stats.read_bytes += size;
+		latency = &stats.read_latency;
+		break;
+	case mtar_io_kind::WRITE:
+		stats.writes++;
+		stats.write_bytes += size;
+		latency = &stats.write_latency;
+		break;
+	default:
+		stats.seeks++;
+		latency = &stats.seek_latency;
+		break;
+	}
+	if (!timing && !trace)
+	{
+		return f();
+	}
+	const auto start = std::chrono::steady_clock::now();
+	const mtar_error err = f();
+	const auto end = std::chrono::steady_clock::now();
+	const std::uint64_t ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	latency->add(ns);
+	if (trace)
+	{
+		trace(mtar_io_event_t{ kind, pos, size, ns, err });
+	}
+	return err;
+#endif
+}
+
+mtar_error mtar_t::io_read(char* data, size_t size)
+{
+	return instrument(mtar_io_kind::READ, read_pos, size, [&]
+	{
+		switch (backend)
+		{
+		case backend_t::STREAM:
+			if (in == nullptr || !in->read(data, size))
+			{
+				return mtar_error::READFAIL;
+			}
+			return mtar_error::SUCCESS;
+		case backend_t::MEMORY:
+			// reads always use read_pos
+			if (read_pos > mem_size || mem_size - read_pos < size)
+			{
+				return mtar_error::READFAIL;
+			}
+			std::copy_n(mem_data + read_pos, size, data);
+			return mtar_error::SUCCESS;
+#ifdef MTAR_POSIX
+		case backend_t::FD:
+			return mtar_fd::read(fd, fd_positional, read_pos, data, size);
+#endif
+		default:
+			return read_func(*this, data, size);
+		}
+	});
+}
+
+mtar_error mtar_t::io_write(mtar_size_t pos, const char* data, size_t size)
+{
+	if (read_only)
+	{
+		return mtar_error::WRITEFAIL;
+	}
+	return instrument(mtar_io_kind::WRITE, pos, size, [&]
+	{
+		switch (backend)
+		{
+		case backend_t::STREAM:
+			if (out == nullptr || !out->write(data, size))
+			{
+				return mtar_error::WRITEFAIL;
+			}
+			return mtar_error::SUCCESS;
+		case backend_t::MEMORY:
+			return mtar_error::WRITEFAIL;
+#ifdef MTAR_POSIX
+		case backend_t::FD:
+			return mtar_fd::write(fd, fd_positional, pos, data, size);
+#endif
+		default:
+			return write_func(*this, data, size);
+		}
+	});
+}
+
+mtar_error mtar_t::io_write(mtar_size_t pos, const char* data1, size_t size1, const char* data2, size_t size2)
+{
+#ifdef MTAR_POSIX
+	if (backend == backend_t::FD && !read_only)
+	{
+		return instrument(mtar_io_kind::WRITE, pos, size1 + size2, [&]
+		{
+			iovec iov[2] = { { const_cast<char*>(data1), size1 }, { const_cast<char*>(data2), size2 } };
+			return mtar_fd::writev(fd, fd_positional, pos, iov, 2);
+		});
+	}
+#endif
+	mtar_error err = io_write(pos, data1, size1);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	return io_write(pos + size1, data2, size2);
+}
+
+mtar_error mtar_t::io_seek(mtar_size_t pos)
+{
+	return instrument(mtar_io_kind::SEEK, pos, 0, [&]
+	{
+		switch (backend)
+		{
+		case backend_t::STREAM:
+			if (in == nullptr || !in->seekg(pos, std::ios::beg))
+			{
+				return mtar_error::SEEKFAIL;
+			}
+			return mtar_error::SUCCESS;
+		case backend_t::MEMORY:
+			return pos > mem_size ? mtar_error::SEEKFAIL : mtar_error::SUCCESS;
+#ifdef MTAR_POSIX
+		case backend_t::FD:
+			// positional reads need no seek, otherwise only forward_only skipping is possible
+			return fd_positional ? mtar_error::SUCCESS : mtar_error::SEEKFAIL;
+#endif
+		default:
+			return seek_func(*this, pos);
+		}
+	});
+}
+
+mtar_error mtar_t::tseek(mtar_size_t pos)
+{
+	/* Padding after data is read instead, which is cheaper than a seek */
+	if (pos > io_pos && pos - io_pos < mtar_record_size)
+	{
+		char padding[mtar_record_size];
+		mtar_error err = io_read(padding, static_cast<size_t>(pos - io_pos));
+		io_pos = err == mtar_error::SUCCESS ? pos : unknown_pos;
+		return err;
+	}
+	if (!forward_only)
+	{
+		mtar_error err = io_seek(pos);
+		io_pos = err == mtar_error::SUCCESS ? pos : unknown_pos;
+		return err;
+	}
+	if (pos < io_pos)
 	{
-		res += static_cast<unsigned char>(rh[i]);
+		return mtar_error::SEEKFAIL;
+	}
+	/* Skip forward by reading */
+	constexpr size_t skip_buffer_size = 1 << 18;
+	if (pos > io_pos && skip_buffer.empty())
+	{
+		skip_buffer.resize(skip_buffer_size);
 	}
-	// include "padding" data in checksum otherwise UStar archives cannot be read
-	for (size_t i = checksum_offset + checksum_size; i < mtar_raw_header_size; i++)
+	while (io_pos < pos)
 	{
-		res += static_cast<unsigned char>(rh[i]);
+		const size_t n = static_cast<size_t>(std::min<mtar_size_t>(pos - io_pos, skip_buffer.size()));
+		mtar_error err = io_read(skip_buffer.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			io_pos = unknown_pos;
+			return err;
+		}
+		io_pos += n;
 	}
-	return res;
+	return mtar_error::SUCCESS;
 }
 
 mtar_error mtar_t::tread(char* data, size_t size)
 {
-	mtar_error err = read_func(*this, data, size);
+	/* Pending writes must reach the backend before it is read */
+	if (write_buffered != 0)
+	{
+		mtar_error err = flush_write_buffer();
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	/* Seek lazily, only if the backend is somewhere else */
+	if (read_pos != io_pos && !positional_read())
+	{
+		mtar_error err = tseek(read_pos);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	mtar_error err = io_read(data, size);
 	read_pos += size;
+	// a failed read may have stopped anywhere, so the next read seeks again
+	io_pos = err == mtar_error::SUCCESS ? io_pos + size : unknown_pos;
 	return err;
 }
 
 mtar_error mtar_t::twrite(const char* data, size_t size)
 {
-	mtar_error err = write_func(*this, data, size);
-	write_pos += size;
+	// streams may share read and write positions, and the archive may have changed
+	io_pos = unknown_pos;
+	header_cached = false;
+	ext_header_pos = unknown_pos;
+	if (write_block_size == 0)
+	{
+		mtar_error err = io_write(write_pos, data, size);
+		write_pos += size;
+		return err;
+	}
+	/* Data that completes whole blocks is written together with the buffer,
+	 * the rest is collected until a block is full */
+	if (size >= write_block_size - write_buffered && write_buffered != 0 && backend != backend_t::FD)
+	{
+		// without writev, completing the buffered block is cheaper than a second call
+		const size_t n = write_block_size - write_buffered;
+		std::copy_n(data, n, write_buffer.data() + write_buffered);
+		write_buffered += n;
+		write_pos += n;
+		data += n;
+		size -= n;
+		mtar_error err = flush_write_buffer();
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	if (size >= write_block_size - write_buffered)
+	{
+		const size_t total = write_buffered + size;
+		const size_t n = total - total % write_block_size - write_buffered;
+		mtar_error err = write_buffered == 0 ?
+			io_write(write_pos, data, n) :
+			io_write(write_pos - write_buffered, write_buffer.data(), write_buffered, data, n);
+		write_pos += n;
+		write_buffered = 0;
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		data += n;
+		size -= n;
+	}
+	if (size > 0)
+	{
+		if (write_buffer.size() != write_block_size)
+		{
+			write_buffer.resize(write_block_size);
+		}
+		std::copy_n(data, size, write_buffer.data() + write_buffered);
+		write_buffered += size;
+		write_pos += size;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::write_null_bytes(size_t n)
+{
+	while (n > NULL_BLOCKSIZE)
+	{
+		mtar_error err = twrite(null_block, NULL_BLOCKSIZE);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		n -= NULL_BLOCKSIZE;
+	}
+	mtar_error err = twrite(null_block, n);
 	return err;
 }
 
-mtar_error mtar_t::write_null_bytes(size_t n)
+mtar_error mtar_t::flush_write_buffer()
+{
+	if (write_buffered == 0)
+	{
+		return mtar_error::SUCCESS;
+	}
+	const size_t n = write_buffered;
+	write_buffered = 0;
+	return io_write(write_pos - n, write_buffer.data(), n);
+}
+
+mtar_error mtar_t::tread_header(const char*& rh)
+{
+	/* Header was read before and not changed since */
+	if (header_cached && read_pos == cached_header_pos)
+	{
+		rh = cached_header.data();
+		read_pos += mtar_raw_header_size;
+#ifndef MTAR_NO_STATS
+		stats.header_cache_hits++;
+#endif
+		return mtar_error::SUCCESS;
+	}
+	/* Parse in place if reading from memory */
+	if (backend == backend_t::MEMORY)
+	{
+		if (read_pos > mem_size || mem_size - read_pos < mtar_raw_header_size)
+		{
+			return mtar_error::READFAIL;
+		}
+		rh = mem_data + read_pos;
+		read_pos += mtar_raw_header_size;
+		return mtar_error::SUCCESS;
+	}
+#ifndef MTAR_NO_STATS
+	stats.header_reads++;
+#endif
+	rh = cached_header.data();
+	cached_header_pos = read_pos;
+	mtar_error err = tread(cached_header.data(), mtar_raw_header_size);
+	header_cached = err == mtar_error::SUCCESS;
+	return err;
+}
+
+bool mtar_t::positional_read() const
+{
+	return backend == backend_t::MEMORY || (backend == backend_t::FD && fd_positional);
+}
+
+mtar_error mtar_t::read_at(mtar_size_t pos, char* data, size_t size)
+{
+	if (backend == backend_t::MEMORY)
+	{
+		if (pos > mem_size || mem_size - pos < size)
+		{
+			return mtar_error::READFAIL;
+		}
+		std::copy_n(mem_data + pos, size, data);
+		return mtar_error::SUCCESS;
+	}
+#ifdef MTAR_POSIX
+	if (backend == backend_t::FD && fd_positional)
+	{
+		return mtar_fd::read(fd, true, pos, data, size);
+	}
+#endif
+	mtar_error err = seek(pos);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	return tread(data, size);
+}
+
+mtar_size_t mtar_t::bytes_after(mtar_size_t pos) const
+{
+	if (backend == backend_t::MEMORY)
+	{
+		return pos > mem_size ? 0 : mem_size - pos;
+	}
+#ifdef MTAR_POSIX
+	struct stat st;
+	if (backend == backend_t::FD && fd_positional && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		const mtar_size_t size = static_cast<mtar_size_t>(st.st_size);
+		return pos > size ? 0 : size - pos;
+	}
+#endif
+	return unknown_pos;
+}
+
+std::ostream* mtar_t::output_stream()
+{
+	return out;
+}
+
+bool mtar_t::positional_write() const
+{
+	return backend == backend_t::FD && fd_positional && !read_only;
+}
+
+mtar_error mtar_t::write_at(mtar_size_t pos, const char* data, size_t size)
+{
+#ifdef MTAR_POSIX
+	if (positional_write())
+	{
+		// called concurrently, so positions, cache and stats are left to the caller
+		return mtar_fd::write(fd, true, pos, data, size);
+	}
+#endif
+	std::ostream* os = output_stream();
+	if (os == nullptr || !os->seekp(pos))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	io_pos = unknown_pos;
+	header_cached = false;
+	ext_header_pos = unknown_pos;
+	return io_write(pos, data, size);
+}
+
+mtar_error mtar_t::raw_to_view(mtar_header_view_t& h, const char* rh)
+{
+	using namespace mtar_raw_header_info;
+
+	/* Check for null record and checksum */
+	mtar_error err = check_header(rh);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+
+	/* Only size is decoded, it is needed to find the next header */
+	if (!mtar_octal::decode(rh + size_offset, size_size, h.size_))
+	{
+		return mtar_error::FAILURE;
+	}
+	h.raw_ = rh;
+	// names are not null terminated if they use all 100 bytes
+	h.name_ = std::string_view(rh + name_offset,
+		std::find(rh + name_offset, rh + name_offset + name_size, '\0') - (rh + name_offset));
+	h.linkname_ = std::string_view(rh + linkname_offset,
+		std::find(rh + linkname_offset, rh + linkname_offset + linkname_size, '\0') - (rh + linkname_offset));
+
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::raw_to_header(mtar_header_t& h, const char* rh)
+{
+	mtar_header_view_t v;
+	mtar_error err = raw_to_view(v, rh);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	return v.to_header(h);
+}
+
+std::uint64_t mtar_header_view_t::mode() const
+{
+	using namespace mtar_raw_header_info;
+	std::uint64_t v = 0;
+	mtar_octal::decode(raw_ + mode_offset, mode_size, v);
+	return v;
+}
+
+std::uint64_t mtar_header_view_t::owner() const
+{
+	using namespace mtar_raw_header_info;
+	std::uint64_t v = 0;
+	mtar_octal::decode(raw_ + owner_offset, owner_size, v);
+	return v;
+}
+
+std::uint64_t mtar_header_view_t::mtime() const
+{
+	using namespace mtar_raw_header_info;
+	std::uint64_t v;
+	if (!mtar_octal::decode(raw_ + mtime_offset, mtime_size, v))
+	{
+		return 0;
+	}
+	return v;
+}
+
+mtar_type mtar_header_view_t::type() const
+{
+	return static_cast<mtar_type>(raw_[mtar_raw_header_info::type_offset]);
+}
+
+mtar_error mtar_header_view_t::to_header(mtar_header_t& h) const
+{
+	using namespace mtar_raw_header_info;
+
+	if (!mtar_octal::decode(raw_ + mode_offset, mode_size, h.mode) ||
+		!mtar_octal::decode(raw_ + owner_offset, owner_size, h.owner) ||
+		!mtar_octal::decode(raw_ + mtime_offset, mtime_size, h.mtime))
+	{
+		return mtar_error::FAILURE;
+	}
+	h.size = size_;
+	h.type = type();
+	// assign reuses the capacity of h when it is read into repeatedly
+	h.name.assign(name_);
+	h.linkname.assign(linkname_);
+
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::header_to_raw(mtar_raw_header_t& rh, const mtar_header_t& h)
+{
+	using namespace mtar_raw_header_info;
+
+	rh = {};
+
+	/* Load header into raw header */
+	if (!mtar_octal::encode(rh.data() + mode_offset, mode_size, h.mode) ||
+		!mtar_octal::encode(rh.data() + owner_offset, owner_size, h.owner) ||
+		!mtar_octal::encode(rh.data() + size_offset, size_size, h.size) ||
+		!mtar_octal::encode(rh.data() + mtime_offset, mtime_size, h.mtime))
+	{
+		return mtar_error::FAILURE;
+	}
+	rh[type_offset] = static_cast<unsigned int>(h.type);
+	if (h.name.size() >= 100)
+	{
+		// leave 1 for null
+		std::copy_n(h.name.begin(), 99, rh.data() + name_offset);
+	}
+	else
+	{
+		std::copy(h.name.begin(), h.name.end(), rh.data() + name_offset);
+	}
+	if (h.linkname.size() >= 100)
+	{
+		std::copy_n(h.linkname.begin(), 99, rh.data() + linkname_offset);
+	}
+	else
+	{
+		std::copy(h.linkname.begin(), h.linkname.end(), rh.data() + linkname_offset);
+	}
+
+	/* Calculate and write checksum */
+	// 6 digits followed by null and space
+	unsigned int chksum = checksum(rh.data());
+	mtar_octal::encode(rh.data() + checksum_offset, checksum_size - 1, chksum);
+	rh[checksum_offset + 7] = ' ';
+
+	return mtar_error::SUCCESS;
+}
+
+std::string mtar_t::pax_records(const mtar_header_t& h)
+{
+	using namespace mtar_raw_header_info;
+	std::string records;
+	// 11 octal digits
+	if (h.size >> 33 != 0)
+	{
+		mtar_pax::append_record(records, "size", std::to_string(h.size));
+	}
+	if (h.name.size() >= name_size)
+	{
+		mtar_pax::append_record(records, "path", h.name);
+	}
+	if (h.linkname.size() >= linkname_size)
+	{
+		mtar_pax::append_record(records, "linkpath", h.linkname);
+	}
+	return records;
+}
+
+void mtar_t::encode_pax_header(std::string& out, const mtar_header_t& h, std::string_view records)
+{
+	if (records.empty())
+	{
+		return;
+	}
+	/* Header for the extended header data, named like other tars do */
+	mtar_header_t ph;
+	const size_t slash = h.name.rfind('/');
+	ph.name = "PaxHeader/" + h.name.substr(slash == std::string::npos ? 0 : slash + 1);
+	ph.mode = 0644;
+	ph.size = records.size();
+	ph.mtime = h.mtime;
+	ph.type = mtar_type::PAX;
+	mtar_raw_header_t rh;
+	header_to_raw(rh, ph);
+	out.append(rh.data(), rh.size());
+	/* Records, padded to a full record */
+	out.append(records);
+	out.append(static_cast<size_t>(round_up(out.size(), mtar_record_size) - out.size()), '\0');
+}
+
+mtar_size_t mtar_t::header_size(const mtar_header_t& h)
+{
+	const std::string records = pax_records(h);
+	if (records.empty())
+	{
+		return mtar_raw_header_size;
+	}
+	return 2 * mtar_raw_header_size + round_up(records.size(), mtar_record_size);
+}
+
+std::string_view mtar_t::strerror(mtar_error err)
+{
+	switch (err)
+	{
+	case mtar_error::SUCCESS:
+		return "success";
+	case mtar_error::FAILURE:
+		return "failure";
+	case mtar_error::OPENFAIL:
+		return "could not open";
+	case mtar_error::READFAIL:
+		return "could not read";
+	case mtar_error::WRITEFAIL:
+		return "could not write";
+	case mtar_error::SEEKFAIL:
+		return "could not seek";
+	case mtar_error::BADCHKSUM:
+		return "bad checksum";
+	case mtar_error::NULLRECORD:
+		return "null record";
+	case mtar_error::NOTFOUND:
+		return "file not found";
+	case mtar_error::BADINDEX:
+		return "invalid or stale index";
+	}
+	return "unknown error";
+}
+
+mtar_t::mtar_t(std::istream& is) : backend(backend_t::STREAM), in(&is), stream{std::ref(is)} {}
+
+mtar_t::mtar_t(std::ostream& os) : backend(backend_t::STREAM), out(&os), stream{std::ref(os)} {}
+
+mtar_t::mtar_t(std::iostream& ios) : backend(backend_t::STREAM), in(&ios), out(&ios), stream{std::ref(ios)} {}
+
+mtar_t::mtar_t(const char* data, size_t size) : backend(backend_t::MEMORY), mem_data(data), mem_size(size) {}
+
+#ifdef MTAR_POSIX
+mtar_t::mtar_t(const mtar_mmap_t& map) : backend(backend_t::MEMORY), mem_data(map.data()), mem_size(map.size()) {}
+
+mtar_t::mtar_t(int fd_) : backend(backend_t::FD), fd(fd_)
+{
+	/* Pipes and sockets can't be read at an offset */
+	fd_positional = ::lseek(fd, 0, SEEK_CUR) >= 0;
+	forward_only = !fd_positional;
+}
+
+mtar_t::mtar_t(const mtar_shared_t& archive) : read_only(true)
+{
+	if (archive.map_.data() != nullptr)
+	{
+		backend = backend_t::MEMORY;
+		mem_data = archive.map_.data();
+		mem_size = archive.map_.size();
+	}
+	else
+	{
+		// checked to be seekable when the archive was opened
+		backend = backend_t::FD;
+		fd = archive.fd_;
+		fd_positional = true;
+	}
+}
+#endif
+
+mtar_t::~mtar_t()
+{
+	flush_write_buffer();
+	if (backend == backend_t::CUSTOM)
+	{
+		close_func(*this);
+	}
+	else if (out != nullptr)
+	{
+		out->flush();
+	}
+}
+
+mtar_error mtar_t::seek(mtar_size_t pos)
+{
+	/* Seeking is deferred until the next read, only check whether we can go back */
+	if (forward_only && pos < io_pos &&
+		!(header_cached && pos == cached_header_pos && io_pos == pos + mtar_raw_header_size))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	read_pos = pos;
+	remaining_data = 0; // clear remaining data to prevent read_header, seek, read_data (error)
+	header_consumed = false;
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::seek_data(std::int64_t off)
+{
+	// if remaining_data is 0 (past end by unknown amount or not in data record at all)
+	// or off is more than remaining_data (seeks past data)
+	// or read_pos + off is less than zero
+	// or read_pos + off is less than data_start (seeks before data)
+	if (remaining_data == 0 || (off > 0 && remaining_data < static_cast<mtar_size_t>(off)) ||
+		(off < 0 && read_pos - data_start < -static_cast<mtar_size_t>(off)))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	if (forward_only && off < 0)
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	read_pos += off;
+	remaining_data -= off;
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::rewind()
+{
+	last_header = 0;
+	next_header = 0;
+	if (!forward_only)
+	{
+		io_pos = unknown_pos;
+	}
+	return seek(0);
+}
+
+mtar_error mtar_t::scan_start()
+{
+	if (!forward_only)
+	{
+		return rewind();
+	}
+	/* Skip rest of an entry whose header was consumed */
+	if (header_consumed && read_pos <= next_header)
+	{
+		return seek(next_header);
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::next()
+{
+	/* Header of current entry was consumed, skip rest of its data
+	 * a seek (e.g. skip_data) leaves no entry consumed, so the header there is read and skipped */
+	if (header_consumed && read_pos <= next_header)
+	{
+		return seek(next_header);
+	}
+	/* Load header (cached if it was peeked) */
+	mtar_header_view_t h;
+	mtar_error err = read_header(h);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* Seek to next record */
+	return seek(next_header);
+}
+
+mtar_error mtar_t::seek_after_data()
+{
+	if (!forward_only)
+	{
+		return seek(last_header);
+	}
+	/* The entry stays consumed, so next() doesn't skip the following one */
+	mtar_error err = seek(next_header);
+	header_consumed = true;
+	return err;
+}
+
+mtar_error mtar_t::skip_data(mtar_size_t data_size)
+{
+	return seek(read_pos + round_up(data_size, mtar_record_size));
+}
+
+mtar_error mtar_t::find(std::string_view name, mtar_header_t& h)
+{
+	/* Start at beginning, or search the rest of the archive if we can't go back */
+	mtar_error err = scan_start();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* Iterate all files until we hit an error or find the file
+	 * headers are compared in place, only the match is copied */
+	mtar_header_view_t header;
+	while ((err = read_header(header)) == mtar_error::SUCCESS)
+	{
+		if (header.name() == name)
+		{
+			err = header.to_header(h);
+			if (err != mtar_error::SUCCESS)
+			{
+				remaining_data = 0;
+			}
+			return err;
+		}
+		skip_data(header.size());
+	}
+	/* Return error */
+	if (err == mtar_error::NULLRECORD)
+	{
+		err = mtar_error::NOTFOUND;
+	}
+	return err;
+}
+
+mtar_error mtar_t::find(std::string_view name, mtar_header_t& h, const mtar_index_t& index)
+{
+	const mtar_index_entry_t* e = index.find(name);
+	if (e == nullptr)
+	{
+		return mtar_error::NOTFOUND;
+	}
+	/* Seek directly to header and consume it */
+	mtar_error err = seek(e->header_offset);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	mtar_header_view_t v;
+	err = read_header(v);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* A stale index can point at another entry */
+	if (v.name() != name || read_pos != e->data_offset || v.size() != e->size || v.type() != e->type)
+	{
+		remaining_data = 0;
+		return mtar_error::BADINDEX;
+	}
+	err = v.to_header(h);
+	if (err != mtar_error::SUCCESS)
+	{
+		remaining_data = 0;
+	}
+	return err;
+}
+
+mtar_error mtar_t::open_entry(const mtar_index_entry_t& e)
+{
+	/* Seek directly to data, header is not read */
+	mtar_error err = seek(e.data_offset);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	last_header = e.header_offset;
+	header_consumed = true;
+	data_start = e.data_offset;
+	remaining_data = e.size;
+	next_header = e.data_offset + round_up(e.size, mtar_record_size);
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::open_entry(std::string_view name, const mtar_index_t& index)
+{
+	const mtar_index_entry_t* e = index.find(name);
+	if (e == nullptr)
+	{
+		return mtar_error::NOTFOUND;
+	}
+	return open_entry(*e);
+}
+
+mtar_error mtar_t::peek_header(mtar_header_t& h)
+{
+	/* Read header, then go back to its start
+	 * the header is cached so this needs no I/O */
+	mtar_error err = read_header(h);
+	read_pos = last_header;
+	remaining_data = 0;
+	header_consumed = false;
+	return err;
+}
+
+mtar_error mtar_t::peek_header(mtar_header_view_t& h)
+{
+	mtar_error err = read_header(h);
+	read_pos = last_header;
+	remaining_data = 0;
+	header_consumed = false;
+	return err;
+}
+
+mtar_error mtar_t::read_header(mtar_header_t& h)
+{
+	mtar_header_view_t v;
+	mtar_error err = read_header(v);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	err = v.to_header(h);
+	if (err != mtar_error::SUCCESS)
+	{
+		remaining_data = 0;
+	}
+	return err;
+}
+
+mtar_error mtar_t::read_header(mtar_header_view_t& h)
+{
+	/* Save header position */
+	last_header = read_pos;
+	header_consumed = false;
+	/* Entry with extended headers that was just read */
+	if (read_pos == ext_header_pos)
+	{
+		read_pos = ext_data_start;
+#ifndef MTAR_NO_STATS
+		stats.header_cache_hits++;
+#endif
+	}
+	else
+	{
+		mtar_pax::overrides_t pax;
+		bool extended = false;
+		while (true)
+		{
+			/* Read raw header */
+			const char* rh;
+			mtar_error err = tread_header(rh);
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			/* Parse raw header in place */
+			err = raw_to_view(h, rh);
+			if (err != mtar_error::SUCCESS)
+			{
+#ifndef MTAR_NO_STATS
+				if (err == mtar_error::BADCHKSUM)
+				{
+					stats.checksum_failures++;
+				}
+#endif
+				return err;
+			}
+#ifndef MTAR_NO_STATS
+			stats.headers_parsed++;
+#endif
+			if (h.type() != mtar_type::PAX && h.type() != mtar_type::PAX_GLOBAL)
+			{
+				break;
+			}
+			/* Extended header data, records of global headers are ignored */
+			const mtar_size_t data_end = read_pos + round_up(h.size_, mtar_record_size);
+			if (h.type() == mtar_type::PAX)
+			{
+				if (h.size_ > max_pax_size || h.size_ > bytes_after(read_pos))
+				{
+					return mtar_error::FAILURE;
+				}
+				pax_buffer.resize(static_cast<size_t>(h.size_));
+				err = tread(pax_buffer.data(), pax_buffer.size());
+				if (err != mtar_error::SUCCESS)
+				{
+					return err;
+				}
+				if (!mtar_pax::parse(pax_buffer, pax))
+				{
+					return mtar_error::FAILURE;
+				}
+				extended = true;
+			}
+			else if (!extended)
+			{
+				// global headers don't belong to the entry (e.g. tombstones left by remove)
+				last_header = data_end;
+			}
+			read_pos = data_end;
+		}
+		if (!extended)
+		{
+			data_start = read_pos;
+			remaining_data = h.size_;
+			next_header = read_pos + round_up(h.size_, mtar_record_size);
+			header_consumed = true;
+			return mtar_error::SUCCESS;
+		}
+		/* Apply extended header, the result is kept so the view stays valid */
+		std::copy_n(h.raw_, mtar_raw_header_size, ext_raw.data());
+		ext_size = pax.has_size ? pax.size : h.size_;
+		if (pax.has_path)
+		{
+			ext_name = std::move(pax.path);
+		}
+		else
+		{
+			ext_name.assign(h.name_);
+		}
+		if (pax.has_linkpath)
+		{
+			ext_linkname = std::move(pax.linkpath);
+		}
+		else
+		{
+			ext_linkname.assign(h.linkname_);
+		}
+		ext_header_pos = last_header;
+		ext_data_start = read_pos;
+	}
+	h.raw_ = ext_raw.data();
+	h.size_ = ext_size;
+	h.name_ = ext_name;
+	h.linkname_ = ext_linkname;
+	data_start = read_pos;
+	remaining_data = h.size_;
+	next_header = read_pos + round_up(h.size_, mtar_record_size);
+	header_consumed = true;
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::read_data(char* data, size_t size)
+{
+	/* If we have no remaining data then this is the first read and header is valid
+	 * we consume the header, which sets the remaining data and puts us in the correct place */
+	if (remaining_data == 0)
+	{
+		/* Read header */
+		mtar_header_view_t h;
+		mtar_error err = read_header(h);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	/* Read data */
+	mtar_error err = tread(data, size);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	remaining_data -= size;
+	/* If there is no remaining data we've finished reading and seek back to the
+	 * header, or skip the padding to the next header in forward-only mode */
+	if (remaining_data == 0)
+	{
+		return seek_after_data();
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::read_data_view(std::string_view& data, size_t size)
+{
+	if (backend != backend_t::MEMORY)
+	{
+		return mtar_error::FAILURE;
+	}
+	/* Consume header if this is the first read, same as read_data */
+	if (remaining_data == 0)
+	{
+		mtar_header_view_t h;
+		mtar_error err = read_header(h);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	if (size > remaining_data || read_pos > mem_size || mem_size - read_pos < size)
+	{
+		return mtar_error::READFAIL;
+	}
+	data = std::string_view(mem_data + read_pos, size);
+	read_pos += size;
+	remaining_data -= size;
+	/* Seek back to header once all data is consumed, same as read_data */
+	if (remaining_data == 0)
+	{
+		return seek_after_data();
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_entries_t mtar_t::entries()
+{
+	return mtar_entries_t(*this);
+}
+
+mtar_size_t mtar_entry_t::remaining() const
+{
+	return tar->remaining_data;
+}
+
+mtar_error mtar_entry_t::read(char* data, size_t size)
+{
+	/* Unlike mtar_t::read_data, this never goes back to the header */
+	if (size > tar->remaining_data)
+	{
+		return mtar_error::READFAIL;
+	}
+	mtar_error err = tar->tread(data, size);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	tar->remaining_data -= size;
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_entry_t::read_view(std::string_view& data, size_t size)
+{
+	if (tar->backend != mtar_t::backend_t::MEMORY)
+	{
+		return mtar_error::FAILURE;
+	}
+	const mtar_size_t pos = tar->read_pos;
+	if (size > tar->remaining_data || pos > tar->mem_size || tar->mem_size - pos < size)
+	{
+		return mtar_error::READFAIL;
+	}
+	data = std::string_view(tar->mem_data + pos, size);
+	tar->read_pos += size;
+	tar->remaining_data -= size;
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_entry_t::stream(const std::function<mtar_error(const char*, size_t)>& sink)
+{
+	if (tar->backend == mtar_t::backend_t::MEMORY)
+	{
+		/* Pass data straight from memory */
+		const mtar_size_t pos = tar->read_pos;
+		const mtar_size_t size = tar->remaining_data;
+		if (pos > tar->mem_size || tar->mem_size - pos < size)
+		{
+			return mtar_error::READFAIL;
+		}
+		tar->read_pos += size;
+		tar->remaining_data = 0;
+		return sink(tar->mem_data + pos, static_cast<size_t>(size));
+	}
+	/* Seek first, since skipping in forward-only mode uses the same buffer */
+	if (tar->read_pos != tar->io_pos)
+	{
+		mtar_error err = tar->tseek(tar->read_pos);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	std::vector<char>& buf = tar->skip_buffer;
+	constexpr size_t chunk_size = 1 << 18;
+	if (buf.size() < chunk_size)
+	{
+		buf.resize(chunk_size);
+	}
+	while (tar->remaining_data > 0)
+	{
+		const size_t n = static_cast<size_t>(std::min<mtar_size_t>(tar->remaining_data, buf.size()));
+		mtar_error err = read(buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		err = sink(buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	return mtar_error::SUCCESS;
+}
+
+bool mtar_entries_t::read_next()
+{
+	error_ = tar->read_header(entry.header_);
+	if (error_ == mtar_error::NULLRECORD)
+	{
+		error_ = mtar_error::SUCCESS;
+		return false;
+	}
+	return error_ == mtar_error::SUCCESS;
+}
+
+mtar_entries_t::iterator mtar_entries_t::begin()
+{
+	error_ = tar->scan_start();
+	if (error_ != mtar_error::SUCCESS || !read_next())
+	{
+		return end();
+	}
+	return iterator(this);
+}
+
+mtar_entries_t::iterator& mtar_entries_t::iterator::operator++()
+{
+	/* Skip whatever is left of the current entry, the seek is deferred until the next read */
+	mtar_t& tar = *range->tar;
+	range->error_ = tar.seek(tar.next_header);
+	if (range->error_ != mtar_error::SUCCESS || !range->read_next())
+	{
+		range = nullptr;
+	}
+	return *this;
+}
+
+mtar_error mtar_t::extract(const std::filesystem::path& dest, const mtar_index_t& index,
+	const std::vector<std::string_view>& names, unsigned threads)
+{
+	namespace fs = std::filesystem;
+
+	/* Select entries */
+	std::vector<const mtar_index_entry_t*> selected;
+	if (names.empty())
+	{
+		for (const mtar_index_entry_t& e : index.entries())
+		{
+			selected.push_back(&e);
+		}
+	}
+	else
+	{
+		for (std::string_view name : names)
+		{
+			const mtar_index_entry_t* e = index.find(name);
+			if (e == nullptr)
+			{
+				return mtar_error::NOTFOUND;
+			}
+			selected.push_back(e);
+		}
+		/* Archive order, for links and duplicate names */
+		std::sort(selected.begin(), selected.end(), [](const mtar_index_entry_t* a, const mtar_index_entry_t* b)
+		{
+			return a->header_offset < b->header_offset;
+		});
+	}
+
+	/* Names are compared lexically, "a/./b" and "a/b/" are the same file */
+	auto normal = [](const fs::path& p)
+	{
+		fs::path n = p.lexically_normal();
+		return n.has_filename() ? n : n.parent_path();
+	};
+	auto outside = [](const fs::path& p)
+	{
+		return p.has_root_path() || std::find(p.begin(), p.end(), fs::path("..")) != p.end();
+	};
+	/* True if a component of p below dest that already exists is a symlink */
+	auto through_symlink = [&](const fs::path& p)
+	{
+		fs::path cur = dest;
+		for (const fs::path& c : p)
+		{
+			cur /= c;
+			std::error_code sec;
+			const fs::file_status s = fs::symlink_status(cur, sec);
+			if (fs::is_symlink(s))
+			{
+				return true;
+			}
+			if (!fs::exists(s))
+			{
+				return false;
+			}
+		}
+		return false;
+	};
+
+	/* Refuse to write outside of dest */
+	for (const mtar_index_entry_t* e : selected)
+	{
+		if (outside(fs::path(index.name(*e))))
+		{
+			return mtar_error::FAILURE;
+		}
+	}
+
+	/* Duplicate names, the last one in archive order wins */
+	{
+		std::unordered_map<fs::path::string_type, size_t> last;
+		for (size_t i = 0; i < selected.size(); i++)
+		{
+			last[normal(fs::path(index.name(*selected[i]))).native()] = i;
+		}
+		size_t kept = 0;
+		for (size_t i = 0; i < selected.size(); i++)
+		{
+			if (last[normal(fs::path(index.name(*selected[i]))).native()] == i)
+			{
+				selected[kept++] = selected[i];
+			}
+		}
+		selected.resize(kept);
+	}
+
+	/* Link targets from the full header, a pax linkpath replaces the ustar field
+	 * links are created after all files, so workers only get the rest */
+	struct link_t
+	{
+		const mtar_index_entry_t* entry;
+		fs::path target;
+	};
+	std::vector<link_t> links;
+	{
+		size_t kept = 0;
+		for (const mtar_index_entry_t* e : selected)
+		{
+			if (e->type != mtar_type::SYM && e->type != mtar_type::LNK)
+			{
+				selected[kept++] = e;
+				continue;
+			}
+			mtar_header_t h;
+			mtar_error err = seek(e->header_offset);
+			if (err == mtar_error::SUCCESS)
+			{
+				err = read_header(h);
+			}
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			/* Symlinks resolve from their own directory, hard links from dest */
+			const fs::path target(h.linkname);
+			const fs::path resolved = e->type == mtar_type::SYM ?
+				normal(fs::path(index.name(*e)).parent_path() / target) : normal(target);
+			if (target.empty() || target.has_root_path() || outside(resolved))
+			{
+				return mtar_error::FAILURE;
+			}
+			links.push_back({ e, e->type == mtar_type::SYM ? target : resolved });
+		}
+		selected.resize(kept);
+	}
+
+	/* Create directories ahead of files, so workers only write data
+	 * nothing is created or written through a symlink that is already below dest */
+	std::error_code ec;
+	for (const mtar_index_entry_t* e : selected)
+	{
+		const fs::path name = normal(fs::path(index.name(*e)));
+		const fs::path p = dest / name;
+		if (e->type == mtar_type::DIR)
+		{
+			if (through_symlink(name))
+			{
+				return mtar_error::FAILURE;
+			}
+			fs::create_directories(p, ec);
+		}
+		else
+		{
+			if (through_symlink(name.parent_path()))
+			{
+				return mtar_error::FAILURE;
+			}
+			fs::create_directories(p.parent_path(), ec);
+			// replace the symlink itself rather than writing to its target
+			std::error_code sec;
+			if (!ec && fs::is_symlink(fs::symlink_status(p, sec)))
+			{
+				fs::remove(p, ec);
+			}
+		}
+		if (ec)
+		{
+			return mtar_error::OPENFAIL;
+		}
+	}
+	for (const link_t& l : links)
+	{
+		const fs::path name = normal(fs::path(index.name(*l.entry)));
+		if (through_symlink(name.parent_path()))
+		{
+			return mtar_error::FAILURE;
+		}
+		fs::create_directories((dest / name).parent_path(), ec);
+		if (ec)
+		{
+			return mtar_error::OPENFAIL;
+		}
+	}
+
+	/* Copy entry data with a pool of workers
+	 * reads are positional, or serialized if the backend has a single cursor */
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(selected.size(), 1)));
+	const bool positional = positional_read();
+	std::mutex read_mutex;
+	std::atomic<size_t> next_entry = 0;
+	std::atomic<mtar_error> result = mtar_error::SUCCESS;
+
+	auto locked_read_at = [&](mtar_size_t pos, char* data, size_t size)
+	{
+		if (positional)
+		{
+			return read_at(pos, data, size);
+		}
+		std::lock_guard lock(read_mutex);
+		return read_at(pos, data, size);
+	};
+
+	auto extract_entry = [&](const mtar_index_entry_t& e, std::vector<char>& buf)
+	{
+		const fs::path p = dest / normal(fs::path(index.name(e)));
+		/* Header is needed for mode */
+		mtar_raw_header_t rh;
+		mtar_error err = locked_read_at(e.data_offset - mtar_record_size, rh.data(), mtar_raw_header_size);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		mtar_header_t h;
+		err = raw_to_header(h, rh.data());
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		std::error_code ec;
+		switch (e.type)
+		{
+		case mtar_type::DIR:
+			fs::permissions(p, static_cast<fs::perms>(h.mode) & fs::perms::mask, ec);
+			return mtar_error::SUCCESS;
+		case mtar_type::CHR:
+		case mtar_type::BLK:
+		case mtar_type::FIFO:
+			// special files are not extracted
+			return mtar_error::SUCCESS;
+		default:
+			break;
+		}
+		std::ofstream file(p, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			return mtar_error::OPENFAIL;
+		}
+		if (backend == backend_t::MEMORY)
+		{
+			/* Write straight from memory */
+			if (e.data_offset > mem_size || mem_size - e.data_offset < e.size)
+			{
+				return mtar_error::READFAIL;
+			}
+			file.write(mem_data + e.data_offset, static_cast<std::streamsize>(e.size));
+		}
+		else
+		{
+			for (mtar_size_t done = 0; done < e.size && file;)
+			{
+				const size_t n = static_cast<size_t>(std::min<mtar_size_t>(e.size - done, buf.size()));
+				err = locked_read_at(e.data_offset + done, buf.data(), n);
+				if (err != mtar_error::SUCCESS)
+				{
+					return err;
+				}
+				file.write(buf.data(), n);
+				done += n;
+			}
+		}
+		if (!file)
+		{
+			return mtar_error::WRITEFAIL;
+		}
+		file.close();
+		fs::permissions(p, static_cast<fs::perms>(h.mode) & fs::perms::mask, ec);
+		return file ? mtar_error::SUCCESS : mtar_error::WRITEFAIL;
+	};
+
+	auto worker = [&]()
+	{
+		constexpr size_t buffer_size = 1 << 20;
+		std::vector<char> buf(backend == backend_t::MEMORY ? 0 : buffer_size);
+		size_t i;
+		while (result.load() == mtar_error::SUCCESS && (i = next_entry.fetch_add(1)) < selected.size())
+		{
+			mtar_error err = extract_entry(*selected[i], buf);
+			if (err != mtar_error::SUCCESS)
+			{
+				mtar_error expected = mtar_error::SUCCESS;
+				result.compare_exchange_strong(expected, err);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& t : pool)
+	{
+		t.join();
+	}
+	if (result != mtar_error::SUCCESS)
+	{
+		return result;
+	}
+
+	/* Links last in archive order, once all files exist
+	 * a link created here can't redirect a file written above */
+	for (const link_t& l : links)
+	{
+		const fs::path name = normal(fs::path(index.name(*l.entry)));
+		if (through_symlink(name.parent_path()) ||
+			(l.entry->type == mtar_type::LNK && through_symlink(l.target.parent_path())))
+		{
+			return mtar_error::FAILURE;
+		}
+		const fs::path p = dest / name;
+		fs::remove(p, ec);
+		if (l.entry->type == mtar_type::SYM)
+		{
+			fs::create_symlink(l.target, p, ec);
+		}
+		else
+		{
+			fs::create_hard_link(dest / l.target, p, ec);
+		}
+		if (ec)
+		{
+			return mtar_error::WRITEFAIL;
+		}
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::extract_all(const std::filesystem::path& dest, unsigned threads)
+{
+	mtar_index_t index;
+	mtar_error err = index.build(*this);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	return extract(dest, index, {}, threads);
+}
+
+mtar_error mtar_t::extract_matching(const mtar_select_t& select, const std::function<mtar_error(mtar_entry_t&)>& sink)
+{
+	/* One pass over all entries, data of entries that aren't selected is skipped */
+	mtar_entries_t range = entries();
+	for (mtar_entry_t& e : range)
+	{
+		if (select.matches(e.header().name()))
+		{
+			mtar_error err = sink(e);
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+		}
+	}
+	return range.error();
+}
+
+mtar_error mtar_t::extract_matching(const mtar_select_t& select, const std::function<mtar_error(mtar_entry_t&)>& sink,
+	const mtar_index_t& index)
+{
+	/* Index entries are in archive order, so reading only moves forward */
+	mtar_entry_t e;
+	e.tar = this;
+	for (const mtar_index_entry_t& ie : index.entries())
+	{
+		if (!select.matches(index.name(ie)))
+		{
+			continue;
+		}
+		mtar_error err = seek(ie.header_offset);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		err = read_header(e.header_);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		err = sink(e);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	return mtar_error::SUCCESS;
+}
+
+#ifdef MTAR_POSIX
+mtar_error mtar_t::extract_to_fd(const mtar_index_entry_t& e, int dst)
+{
+	if (backend == backend_t::FD && fd_positional)
+	{
+		/* Buffered writes must be in the file before it is read */
+		mtar_error err = flush_write_buffer();
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+#ifndef MTAR_NO_STATS
+		stats.reads++;
+		stats.read_bytes += e.size;
+#endif
+		mtar_size_t pos = e.data_offset;
+		return mtar_fd::copy(fd, &pos, dst, false, 0, e.size, skip_buffer);
+	}
+	mtar_error err = open_entry(e);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	if (backend == backend_t::MEMORY)
+	{
+		/* Write straight from memory */
+		if (read_pos > mem_size || mem_size - read_pos < e.size)
+		{
+			return mtar_error::READFAIL;
+		}
+		err = mtar_fd::write(dst, false, 0, mem_data + read_pos, static_cast<size_t>(e.size));
+		remaining_data = 0;
+		return err;
+	}
+	/* Copy through a buffer, any seek happens before the buffer is in use */
+	if (read_pos != io_pos)
+	{
+		err = tseek(read_pos);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	constexpr size_t buffer_size = 1 << 18;
+	std::vector<char> buf(static_cast<size_t>(std::min<mtar_size_t>(e.size, buffer_size)));
+	while (remaining_data > 0)
+	{
+		const size_t n = static_cast<size_t>(std::min<mtar_size_t>(remaining_data, buf.size()));
+		err = tread(buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		remaining_data -= n;
+		err = mtar_fd::write(dst, false, 0, buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	return mtar_error::SUCCESS;
+}
+#endif
+
+mtar_error mtar_t::write_header(const mtar_header_t& h)
+{
+	/* Fields that don't fit in the ustar header go in an extended header first */
+	const std::string records = pax_records(h);
+	if (!records.empty())
+	{
+		std::string ext;
+		encode_pax_header(ext, h, records);
+		mtar_error err = twrite(ext.data(), ext.size());
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	/* Build raw header and write */
+	mtar_raw_header_t rh;
+	header_to_raw(rh, h);
+	remaining_data = h.size;
+	return twrite(rh.data(), mtar_raw_header_size);
+}
+
+mtar_error mtar_t::write_file_header(std::string_view name, mtar_size_t size)
+{
+	/* Build header */
+	mtar_header_t h;
+	h.name = name;
+	h.size = size;
+	h.type = mtar_type::REG;
+	h.mode = 0664;
+	/* Write header */
+	return write_header(h);
+}
+
+mtar_error mtar_t::write_dir_header(std::string_view name)
+{
+	/* Build header */
+	mtar_header_t h;
+	h.name = name;
+	h.type = mtar_type::DIR;
+	h.mode = 0775;
+	/* Write header */
+	return write_header(h);
+}
+
+mtar_error mtar_t::write_data(const char* data, size_t size)
+{
+	/* Write data */
+	mtar_error err = twrite(data, size);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	remaining_data -= size;
+	/* Write padding if we've written all the data for this file */
+	if (remaining_data == 0)
+	{
+		return write_null_bytes(round_up(write_pos, mtar_record_size) - write_pos);
+	}
+	return mtar_error::SUCCESS;
+}
+
+#ifdef MTAR_POSIX
+mtar_error mtar_t::write_file_from_fd(std::string_view name, int src, mtar_size_t size)
+{
+	mtar_error err = write_file_header(name, size);
+	if (err != mtar_error::SUCCESS || size == 0)
+	{
+		return err;
+	}
+	if (backend == backend_t::FD && !read_only)
+	{
+		/* Header and anything buffered before it go first */
+		err = flush_write_buffer();
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+#ifndef MTAR_NO_STATS
+		stats.writes++;
+		stats.write_bytes += size;
+#endif
+		io_pos = unknown_pos;
+		header_cached = false;
+		ext_header_pos = unknown_pos;
+		err = mtar_fd::copy(src, nullptr, fd, fd_positional, write_pos, size, skip_buffer);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		write_pos += size;
+		remaining_data = 0;
+		return write_null_bytes(round_up(write_pos, mtar_record_size) - write_pos);
+	}
+	/* Copy through a buffer for other backends */
+	constexpr size_t buffer_size = 1 << 18;
+	std::vector<char> buf(static_cast<size_t>(std::min<mtar_size_t>(size, buffer_size)));
+	while (remaining_data > 0)
+	{
+		const size_t n = static_cast<size_t>(std::min<mtar_size_t>(remaining_data, buf.size()));
+		err = mtar_fd::read(src, false, 0, buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		err = write_data(buf.data(), n);
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	return mtar_error::SUCCESS;
+}
+#endif
+
+mtar_error mtar_t::write_parallel(const std::vector<mtar_source_t>& sources, unsigned threads)
+{
+	if (output_stream() == nullptr && !positional_write())
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	/* Entries are written at their own offsets, buffered data goes first */
+	mtar_error err = flush_write_buffer();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+
+	/* Compute layout, every entry is a header followed by padded data */
+	std::vector<mtar_size_t> offsets(sources.size() + 1);
+	offsets[0] = write_pos;
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		const mtar_source_t& src = sources[i];
+		if (src.path.empty() && src.data.size() != src.header.size)
+		{
+			return mtar_error::FAILURE;
+		}
+		offsets[i + 1] = offsets[i] + header_size(src.header) + round_up(src.header.size, mtar_record_size);
+	}
+
+	/* Streams in memory can't seek past their end, so entries that are written
+	 * before the ones ahead of them would fail, extend the output to its final size first */
+	std::ostream* os = output_stream();
+	if (os != nullptr && !positional_write() && !os->seekp(offsets.back()))
+	{
+		os->clear();
+		if (!os->seekp(0, std::ios::end))
+		{
+			return mtar_error::SEEKFAIL;
+		}
+		const std::array<char, mtar_record_size * 16> zeros = {};
+		for (mtar_size_t end = static_cast<mtar_size_t>(os->tellp()); end < offsets.back();)
+		{
+			const size_t n = static_cast<size_t>(std::min<mtar_size_t>(offsets.back() - end, zeros.size()));
+			if (!os->write(zeros.data(), n))
+			{
+				return mtar_error::WRITEFAIL;
+			}
+			end += n;
+		}
+	}
+
+	/* Fill entries with a pool of workers
+	 * writes are positional, or serialized if the backend has a single cursor */
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(sources.size(), 1)));
+	const bool positional = positional_write();
+	std::mutex write_mutex;
+	std::atomic<size_t> next_entry = 0;
+	std::atomic<mtar_error> result = mtar_error::SUCCESS;
+
+	auto locked_write_at = [&](mtar_size_t pos, const char* data, size_t size)
+	{
+		if (positional)
+		{
+			return write_at(pos, data, size);
+		}
+		std::lock_guard lock(write_mutex);
+		return write_at(pos, data, size);
+	};
+
+	auto write_entry = [&](size_t i, std::vector<char>& buf)
+	{
+		const mtar_source_t& src = sources[i];
+		const mtar_size_t size = src.header.size;
+		/* Headers go at the start of the first chunk */
+		std::string headers;
+		encode_pax_header(headers, src.header, pax_records(src.header));
+		mtar_raw_header_t rh;
+		header_to_raw(rh, src.header);
+		headers.append(rh.data(), rh.size());
+		if (headers.size() > buf.size())
+		{
+			return mtar_error::FAILURE;
+		}
+		std::copy(headers.begin(), headers.end(), buf.begin());
+		size_t used = headers.size();
+
+		std::ifstream in;
+		if (!src.path.empty())
+		{
+			in.open(src.path, std::ios::binary);
+			if (!in)
+			{
+				return mtar_error::OPENFAIL;
+			}
+		}
+		mtar_size_t pos = offsets[i];
+		mtar_size_t done = 0;
+		while (true)
+		{
+			/* Fill rest of chunk with data */
+			const size_t n = static_cast<size_t>(std::min<mtar_size_t>(size - done, buf.size() - used));
+			if (src.path.empty())
+			{
+				std::copy_n(src.data.data() + done, n, buf.data() + used);
+			}
+			else if (!in.read(buf.data() + used, n))
+			{
+				return mtar_error::READFAIL;
+			}
+			used += n;
+			done += n;
+			/* Padding on the last chunk, buffer size is a multiple of the record size */
+			if (done == size)
+			{
+				const size_t padded = static_cast<size_t>(round_up(used, mtar_record_size));
+				std::fill(buf.data() + used, buf.data() + padded, '\0');
+				used = padded;
+			}
+			mtar_error err = locked_write_at(pos, buf.data(), used);
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			pos += used;
+			used = 0;
+			if (done == size)
+			{
+				return mtar_error::SUCCESS;
+			}
+		}
+	};
+
+	auto worker = [&]()
+	{
+		constexpr size_t buffer_size = 1 << 20;
+		std::vector<char> buf(buffer_size);
+		size_t i;
+		while (result.load() == mtar_error::SUCCESS && (i = next_entry.fetch_add(1)) < sources.size())
+		{
+			mtar_error err = write_entry(i, buf);
+			if (err != mtar_error::SUCCESS)
+			{
+				mtar_error expected = mtar_error::SUCCESS;
+				result.compare_exchange_strong(expected, err);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& t : pool)
+	{
+		t.join();
+	}
+	if (result != mtar_error::SUCCESS)
+	{
+		return result;
+	}
+
+	/* Continue sequential writing after the last entry */
+	write_pos = offsets.back();
+	remaining_data = 0;
+	io_pos = unknown_pos;
+	header_cached = false;
+	ext_header_pos = unknown_pos;
+	if (os != nullptr && !os->seekp(write_pos))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::set_append_pos(mtar_size_t pos)
+{
+	mtar_error err = flush_write_buffer();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	write_pos = pos;
+	remaining_data = 0;
+	io_pos = unknown_pos;
+	header_cached = false;
+	ext_header_pos = unknown_pos;
+	std::ostream* os = output_stream();
+	if (os != nullptr && !os->seekp(write_pos))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::open_append()
+{
+	if (forward_only || (output_stream() == nullptr && !positional_write()))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	/* Walk headers up to the first null record
+	 * data can contain null records too, so the end can't be found by scanning backwards */
+	mtar_error err = rewind();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	mtar_header_view_t h;
+	while ((err = read_header(h)) == mtar_error::SUCCESS)
+	{
+		err = skip_data(h.size());
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	if (err != mtar_error::NULLRECORD)
+	{
+		return err;
+	}
+	return set_append_pos(last_header);
+}
+
+mtar_error mtar_t::open_append(const mtar_index_t& index)
+{
+	if (forward_only || (output_stream() == nullptr && !positional_write()))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	/* Only the end of archive is checked, see mtar_index_t::validate for a full check */
+	mtar_error err = seek(index.end_offset);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	mtar_header_view_t h;
+	if (read_header(h) != mtar_error::NULLRECORD)
+	{
+		return mtar_error::BADINDEX;
+	}
+	return set_append_pos(index.end_offset);
+}
+
+mtar_error mtar_t::write_tombstone(mtar_size_t pos, mtar_size_t size)
+{
+	/* Global headers whose data is a single comment record, which readers ignore
+	 * only the start of the record and its newline are written, the old data stays as the comment
+	 * tar reads global headers into memory, so large areas are split into several */
+	constexpr mtar_size_t max_size = 64 << 20;
+	mtar_header_t th;
+	th.name = "GlobalHead/deleted";
+	th.mode = 0644;
+	th.type = mtar_type::PAX_GLOBAL;
+	mtar_raw_header_t rh;
+	while (size > 0)
+	{
+		const mtar_size_t n = std::min(size, max_size);
+		th.size = n - mtar_raw_header_size;
+		header_to_raw(rh, th);
+		mtar_error err = write_at(pos, rh.data(), rh.size());
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		if (th.size > 0)
+		{
+			const std::string prefix = std::to_string(th.size) + " comment=";
+			err = write_at(pos + mtar_raw_header_size, prefix.data(), prefix.size());
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			err = write_at(pos + n - 1, "\n", 1);
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+		}
+		pos += n;
+		size -= n;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::begin_update()
+{
+	if (output_stream() == nullptr && !positional_write())
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	// positional write_at leaves the cache to the caller, and nothing read from here on fills it
+	io_pos = unknown_pos;
+	header_cached = false;
+	ext_header_pos = unknown_pos;
+	/* Buffered data goes first, since updates move the output position */
+	return flush_write_buffer();
+}
+
+mtar_error mtar_t::end_update()
+{
+	/* Continue sequential writing where it was */
+	std::ostream* os = output_stream();
+	if (os != nullptr && !os->seekp(write_pos))
+	{
+		return mtar_error::SEEKFAIL;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::replace(std::string_view name, const char* data, size_t size, mtar_index_t& index)
+{
+	const auto it = index.lookup_.find(name);
+	if (it == index.lookup_.end())
+	{
+		return mtar_error::NOTFOUND;
+	}
+	mtar_index_entry_t& e = index.entries_[it->second];
+	const mtar_size_t slot = round_up(e.size, mtar_record_size);
+	const mtar_size_t used = round_up(size, mtar_record_size);
+	/* Sizes that need a pax record would change the extended header */
+	if (used > slot || e.size >> 33 != 0 || size >> 33 != 0)
+	{
+		return mtar_error::FAILURE;
+	}
+	mtar_error err = begin_update();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* Other tars may write a pax size record for any entry, which would override the new size */
+	mtar_size_t pos = e.header_offset;
+	while (pos < e.data_offset - mtar_raw_header_size)
+	{
+		mtar_raw_header_t xh;
+		mtar_header_view_t xv;
+		err = read_at(pos, xh.data(), xh.size());
+		if (err == mtar_error::SUCCESS)
+		{
+			err = raw_to_view(xv, xh.data());
+		}
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		if (xv.type() == mtar_type::PAX)
+		{
+			if (xv.size() > max_pax_size)
+			{
+				return mtar_error::FAILURE;
+			}
+			std::string records(static_cast<size_t>(xv.size()), '\0');
+			mtar_pax::overrides_t pax;
+			err = read_at(pos + mtar_raw_header_size, records.data(), records.size());
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			if (!mtar_pax::parse(records, pax) || pax.has_size)
+			{
+				return mtar_error::FAILURE;
+			}
+		}
+		pos += mtar_raw_header_size + round_up(xv.size(), mtar_record_size);
+	}
+	/* Header with the new size, the other fields are kept as they are */
+	using namespace mtar_raw_header_info;
+	const mtar_size_t header_pos = e.data_offset - mtar_raw_header_size;
+	mtar_raw_header_t rh;
+	err = read_at(header_pos, rh.data(), rh.size());
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	err = check_header(rh.data());
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	const std::uint64_t old_digest = mtar_index_info::entry_digest(e, name, rh.data());
+	// the whole field is rewritten, so a base-256 size becomes octal
+	mtar_octal::encode(rh.data() + size_offset, size_size, size);
+	mtar_octal::encode(rh.data() + checksum_offset, checksum_size - 1, checksum(rh.data()));
+	rh[checksum_offset + 7] = ' ';
+
+	/* Data and padding, then records that are no longer used, and the header last */
+	err = write_at(e.data_offset, data, size);
+	if (err == mtar_error::SUCCESS && used != size)
+	{
+		err = write_at(e.data_offset + size, null_block, static_cast<size_t>(used - size));
+	}
+	const bool last = e.data_offset + slot == index.end_offset;
+	if (err == mtar_error::SUCCESS && used != slot)
+	{
+		// the last entry is followed by the end records instead, see remove
+		err = last ? write_at(e.data_offset + used, null_block, 2 * mtar_record_size) :
+			write_tombstone(e.data_offset + used, slot - used);
+	}
+	if (err == mtar_error::SUCCESS)
+	{
+		err = write_at(header_pos, rh.data(), rh.size());
+	}
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	if (last)
+	{
+		index.end_offset = e.data_offset + used;
+	}
+	e.size = size;
+	index.digest_ += mtar_index_info::entry_digest(e, name, rh.data()) - old_digest;
+	return end_update();
+}
+
+mtar_error mtar_t::remove(std::string_view name, mtar_index_t& index)
+{
+	const auto it = index.lookup_.find(name);
+	if (it == index.lookup_.end())
+	{
+		return mtar_error::NOTFOUND;
+	}
+	const size_t i = it->second;
+	const mtar_index_entry_t e = index.entries_[i];
+	mtar_error err = begin_update();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* The ustar header is part of the index digest */
+	mtar_raw_header_t rh;
+	err = read_at(e.data_offset - mtar_raw_header_size, rh.data(), rh.size());
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	const mtar_size_t end = e.data_offset + round_up(e.size, mtar_record_size);
+	if (end == index.end_offset)
+	{
+		/* The last entry is cut off instead, readers don't expect a global header right before the end
+		 * the archive now ends after the previous entry, dropping any tombstones in between */
+		const mtar_size_t new_end = i == 0 ? 0 :
+			index.entries_[i - 1].data_offset + round_up(index.entries_[i - 1].size, mtar_record_size);
+		err = write_at(new_end, null_block, 2 * mtar_record_size);
+		index.end_offset = new_end;
+	}
+	else
+	{
+		/* Headers and data of the entry become a tombstone */
+		err = write_tombstone(e.header_offset, end - e.header_offset);
+	}
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	index.digest_ -= mtar_index_info::entry_digest(e, name, rh.data());
+	index.entries_.erase(index.entries_.begin() + i);
+	index.rebuild_lookup();
+	return end_update();
+}
+
+mtar_error mtar_t::compact(mtar_t& out)
+{
+	if (&out == this)
+	{
+		return mtar_error::FAILURE;
+	}
+	mtar_error err = rewind();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	/* Copy each entry with its extended headers, read_header skips the global headers before it */
+	std::vector<char>& buf = skip_buffer;
+	constexpr size_t chunk_size = 1 << 18;
+	if (buf.size() < chunk_size)
+	{
+		buf.resize(chunk_size);
+	}
+	mtar_header_view_t h;
+	while ((err = read_header(h)) == mtar_error::SUCCESS)
+	{
+		const mtar_size_t end = next_header;
+		err = seek(last_header);
+		while (err == mtar_error::SUCCESS && read_pos < end)
+		{
+			const size_t n = static_cast<size_t>(std::min<mtar_size_t>(end - read_pos, buf.size()));
+			err = tread(buf.data(), n);
+			if (err == mtar_error::SUCCESS)
+			{
+				err = out.twrite(buf.data(), n);
+			}
+		}
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+	}
+	if (err != mtar_error::NULLRECORD)
+	{
+		return err;
+	}
+	return out.finalize();
+}
+
+mtar_size_t mtar_t::archive_size(const std::vector<mtar_source_t>& sources)
+{
+	mtar_size_t size = 2 * mtar_record_size;
+	for (const mtar_source_t& src : sources)
+	{
+		size += header_size(src.header) + round_up(src.header.size, mtar_record_size);
+	}
+	return size;
+}
+
+mtar_error mtar_t::build(const std::vector<mtar_source_t>& sources, char* out, size_t size)
+{
+	if (archive_size(sources) != size)
+	{
+		return mtar_error::FAILURE;
+	}
+	char* p = out;
+	std::string ext;
+	mtar_raw_header_t rh;
+	for (const mtar_source_t& src : sources)
+	{
+		const mtar_header_t& h = src.header;
+		if (src.path.empty() && src.data.size() != h.size)
+		{
+			return mtar_error::FAILURE;
+		}
+		/* Headers */
+		ext.clear();
+		encode_pax_header(ext, h, pax_records(h));
+		p = std::copy(ext.begin(), ext.end(), p);
+		if (header_to_raw(rh, h) != mtar_error::SUCCESS)
+		{
+			return mtar_error::FAILURE;
+		}
+		p = std::copy(rh.begin(), rh.end(), p);
+		/* Data, the layout fits size so it fits in memory */
+		const size_t n = static_cast<size_t>(h.size);
+		if (src.path.empty())
+		{
+			p = std::copy_n(src.data.data(), n, p);
+		}
+		else
+		{
+			std::ifstream in(src.path, std::ios::binary);
+			if (!in)
+			{
+				return mtar_error::OPENFAIL;
+			}
+			if (!in.read(p, static_cast<std::streamsize>(n)))
+			{
+				return mtar_error::READFAIL;
+			}
+			p += n;
+		}
+		/* Padding */
+		const size_t padding = static_cast<size_t>(round_up(h.size, mtar_record_size) - h.size);
+		p = std::fill_n(p, padding, '\0');
+	}
+	/* Two NULL records */
+	std::fill_n(p, 2 * mtar_record_size, '\0');
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::build(const std::vector<mtar_source_t>& sources, std::unique_ptr<char[]>& out, size_t& size)
+{
+	const mtar_size_t total = archive_size(sources);
+	if (total > std::numeric_limits<size_t>::max())
+	{
+		return mtar_error::FAILURE;
+	}
+	/* Every byte is written by build, so the buffer is left uninitialized */
+	size = static_cast<size_t>(total);
+	out.reset(new char[size]);
+	return build(sources, out.get(), size);
+}
+
+mtar_error mtar_t::finalize()
+{
+	/* Write two NULL records */
+	mtar_error err = write_null_bytes(mtar_record_size * 2);
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	return flush_write_buffer();
+}
+
+mtar_error mtar_t::flush()
+{
+	mtar_error err = flush_write_buffer();
+	if (err != mtar_error::SUCCESS)
+	{
+		return err;
+	}
+	if (backend == backend_t::STREAM && out != nullptr && !out->flush())
+	{
+		return mtar_error::WRITEFAIL;
+	}
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_t::set_block_size(size_t size)
+{
+	mtar_error err = flush_write_buffer();
+	write_block_size = size;
+	write_buffer.clear();
+	write_buffer.shrink_to_fit();
+	return err;
+}
+
+/* Glob matching, iterative with backtracking to the last star */
+namespace
+{
+	namespace mtar_glob
+	{
+		// match character class starting after '[', p is moved past the closing ']'
+		// returns false if the class is not closed, then '[' is matched literally
+		bool match_class(std::string_view pattern, size_t& p, char c, bool& matched)
+		{
+			size_t i = p;
+			bool negate = false;
+			if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'))
+			{
+				negate = true;
+				i++;
+			}
+			bool found = false;
+			bool first = true;
+			while (i < pattern.size() && (first || pattern[i] != ']'))
+			{
+				first = false;
+				char lo = pattern[i];
+				if (lo == '\\' && i + 1 < pattern.size())
+				{
+					lo = pattern[++i];
+				}
+				char hi = lo;
+				if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+				{
+					i += 2;
+					hi = pattern[i];
+					if (hi == '\\' && i + 1 < pattern.size())
+					{
+						hi = pattern[++i];
+					}
+				}
+				if (c >= lo && c <= hi)
+				{
+					found = true;
+				}
+				i++;
+			}
+			if (i >= pattern.size())
+			{
+				return false;
+			}
+			p = i + 1;
+			matched = found != negate;
+			return true;
+		}
+
+		bool match(std::string_view pattern, std::string_view name)
+		{
+			size_t p = 0, n = 0;
+			size_t star_p = std::string_view::npos, star_n = 0;
+			while (n < name.size())
+			{
+				if (p < pattern.size())
+				{
+					const char c = pattern[p];
+					if (c == '*')
+					{
+						star_p = ++p;
+						star_n = n;
+						continue;
+					}
+					if (c == '?')
+					{
+						p++;
+						n++;
+						continue;
+					}
+					if (c == '[')
+					{
+						size_t q = p + 1;
+						bool matched;
+						if (match_class(pattern, q, name[n], matched))
+						{
+							if (matched)
+							{
+								p = q;
+								n++;
+								continue;
+							}
+						}
+						else if (name[n] == '[')
+						{
+							p++;
+							n++;
+							continue;
+						}
+					}
+					else
+					{
+						const bool escaped = c == '\\' && p + 1 < pattern.size();
+						if (pattern[escaped ? p + 1 : p] == name[n])
+						{
+							p += escaped ? 2 : 1;
+							n++;
+							continue;
+						}
+					}
+				}
+				/* Mismatch, let the last star consume one more character */
+				if (star_p == std::string_view::npos)
+				{
+					return false;
+				}
+				p = star_p;
+				n = ++star_n;
+			}
+			while (p < pattern.size() && pattern[p] == '*')
+			{
+				p++;
+			}
+			return p == pattern.size();
+		}
+	};
+}
+
+mtar_select_t& mtar_select_t::name(std::string_view n)
+{
+	auto it = std::lower_bound(names_.begin(), names_.end(), n);
+	if (it == names_.end() || *it != n)
+	{
+		names_.emplace(it, n);
+	}
+	return *this;
+}
+
+mtar_select_t& mtar_select_t::prefix(std::string_view p)
+{
+	prefixes_.emplace_back(p);
+	return *this;
+}
+
+mtar_select_t& mtar_select_t::glob(std::string_view g)
+{
+	globs_.emplace_back(g);
+	return *this;
+}
+
+bool mtar_select_t::matches(std::string_view name) const
 {
-	while (n > NULL_BLOCKSIZE)
+	auto it = std::lower_bound(names_.begin(), names_.end(), name);
+	if (it != names_.end() && *it == name)
 	{
-		mtar_error err = twrite(null_block, NULL_BLOCKSIZE);
-		if (err != mtar_error::SUCCESS)
+		return true;
+	}
+	for (const std::string& p : prefixes_)
+	{
+		if (name.substr(0, p.size()) == p)
 		{
-			return err;
+			return true;
 		}
-		n -= NULL_BLOCKSIZE;
 	}
-	mtar_error err = twrite(null_block, n);
-	return err;
-}
-
-mtar_error mtar_t::raw_to_header(mtar_header_t& h, const mtar_raw_header_t& rh)
-{
-	using namespace mtar_raw_header_info;
-
-	/* If the checksum starts with a null byte we assume the record is NULL */
-	if (rh[checksum_offset] == '\0')
+	for (const std::string& g : globs_)
 	{
-		return mtar_error::NULLRECORD;
+		if (mtar_glob::match(g, name))
+		{
+			return true;
+		}
 	}
+	return false;
+}
 
-	/* Build and compare checksum */
-	unsigned int chksum1 = checksum(rh);
-	unsigned int chksum2;
-	std::errc ec = std::from_chars(
-		rh.data() + checksum_offset, rh.data() + checksum_offset + checksum_size,
-		chksum2, 8).ec;
-	if (ec != std::errc() || chksum1 != chksum2)
+void mtar_index_t::rebuild_lookup()
+{
+	lookup_.clear();
+	lookup_.reserve(entries_.size());
+	for (size_t i = 0; i < entries_.size(); i++)
 	{
-		return mtar_error::BADCHKSUM;
+		// emplace does not overwrite, so the first entry with a name is kept
+		lookup_.emplace(name(entries_[i]), i);
 	}
+}
 
-	/* Load raw header into header */
-	ec = std::from_chars(
-		rh.data() + mode_offset, rh.data() + mode_offset + mode_size,
-		h.mode, 8).ec;
-	if (ec != std::errc())
-	{
-		return mtar_error::FAILURE;
-	}
-	ec = std::from_chars(
-		rh.data() + owner_offset, rh.data() + owner_offset + owner_size,
-		h.owner, 8).ec;
-	if (ec != std::errc())
+mtar_error mtar_index_t::build(mtar_t& tar)
+{
+	clear();
+	/* Start at beginning */
+	mtar_error err = tar.rewind();
+	if (err != mtar_error::SUCCESS)
 	{
-		return mtar_error::FAILURE;
+		return err;
 	}
-	ec = std::from_chars(
-		rh.data() + size_offset, rh.data() + size_offset + size_size,
-		h.size, 8).ec;
-	if (ec != std::errc())
+	/* Record every header until we hit the end or an error */
+	digest_ = 0;
+	mtar_header_view_t h;
+	while ((err = tar.read_header(h)) == mtar_error::SUCCESS)
 	{
-		return mtar_error::FAILURE;
+		mtar_index_entry_t e;
+		e.header_offset = tar.last_header;
+		e.data_offset = tar.read_pos;
+		e.size = h.size();
+		e.type = h.type();
+		e.name_offset = names_.size();
+		e.name_size = h.name().size();
+		names_.insert(names_.end(), h.name().begin(), h.name().end());
+		digest_ += mtar_index_info::entry_digest(e, h.name(), h.raw());
+		entries_.push_back(e);
+		err = tar.skip_data(h.size());
+		if (err != mtar_error::SUCCESS)
+		{
+			clear();
+			return err;
+		}
 	}
-	ec = std::from_chars(
-		rh.data() + mtime_offset, rh.data() + mtime_offset + mtime_size,
-		h.mtime, 8).ec;
-	if (ec != std::errc())
+	if (err != mtar_error::NULLRECORD)
 	{
-		return mtar_error::FAILURE;
+		clear();
+		return err;
 	}
-	h.type = static_cast<mtar_type>(rh[type_offset]);
-	h.name = std::string(rh.data() + name_offset);
-	h.linkname = std::string(rh.data() + linkname_offset, linkname_size);
-
+	end_offset = tar.last_header;
+	const mtar_size_t size = tar.bytes_after(0);
+	archive_size_ = size == mtar_t::unknown_pos ? 0 : size;
+	/* Names are only referenced once storage is final */
+	rebuild_lookup();
 	return mtar_error::SUCCESS;
 }
 
-mtar_error mtar_t::header_to_raw(mtar_raw_header_t& rh, const mtar_header_t& h)
+void mtar_index_t::clear()
 {
-	using namespace mtar_raw_header_info;
-
-	rh = {};
+	entries_.clear();
+	names_.clear();
+	lookup_.clear();
+	end_offset = 0;
+	digest_ = 0;
+	archive_size_ = 0;
+}
 
-	/* Load header into raw header */
-	// there should be no errors so we don't need to handle any
-	std::to_chars(rh.data() + mode_offset, rh.data() + mode_offset + mode_size, h.mode, 8);
-	std::to_chars(rh.data() + owner_offset, rh.data() + owner_offset + owner_size, h.owner, 8);
-	std::to_chars(rh.data() + size_offset, rh.data() + size_offset + size_size, h.size, 8);
-	std::to_chars(rh.data() + mtime_offset, rh.data() + mtime_offset + mtime_size, h.mtime, 8);
-	rh[type_offset] = static_cast<unsigned int>(h.type);
-	if (h.name.size() >= 100)
+const mtar_index_entry_t* mtar_index_t::find(std::string_view name) const
+{
+	auto it = lookup_.find(name);
+	if (it == lookup_.end())
 	{
-		// leave 1 for null
-		std::copy_n(h.name.begin(), 99, rh.data() + name_offset);
+		return nullptr;
 	}
-	else
+	return &entries_[it->second];
+}
+
+std::string_view mtar_index_t::name(const mtar_index_entry_t& e) const
+{
+	return { names_.data() + e.name_offset, e.name_size };
+}
+
+mtar_error mtar_index_t::save(std::ostream& os) const
+{
+	using namespace mtar_index_info;
+	/* Write header */
+	char buf[header_size]{};
+	std::copy(std::begin(magic), std::end(magic), buf);
+	put_u64(buf + 8, version); // version + reserved
+	put_u64(buf + 16, entries_.size());
+	put_u64(buf + 24, names_.size());
+	put_u64(buf + 32, end_offset);
+	put_u64(buf + 40, digest_);
+	put_u64(buf + 48, archive_size_);
+	os.write(buf, header_size);
+	/* Write entries */
+	for (const mtar_index_entry_t& e : entries_)
 	{
-		std::copy(h.name.begin(), h.name.end(), rh.data() + name_offset);
+		char ebuf[entry_size]{};
+		put_u64(ebuf, e.header_offset);
+		put_u64(ebuf + 8, e.data_offset);
+		put_u64(ebuf + 16, e.size);
+		put_u64(ebuf + 24, e.name_offset);
+		put_u64(ebuf + 32, e.name_size); // name size + type + reserved
+		ebuf[36] = static_cast<char>(e.type);
+		os.write(ebuf, entry_size);
 	}
-	if (h.linkname.size() >= 100)
+	/* Write names */
+	os.write(names_.data(), names_.size());
+	if (!os)
 	{
-		std::copy_n(h.linkname.begin(), 99, rh.data() + linkname_offset);
+		return mtar_error::WRITEFAIL;
 	}
-	else
+	return mtar_error::SUCCESS;
+}
+
+mtar_error mtar_index_t::load(std::string_view data)
+{
+	using namespace mtar_index_info;
+	clear();
+	/* Check header */
+	if (data.size() < header_size || !std::equal(std::begin(magic), std::end(magic), data.data()) ||
+		(get_u64(data.data() + 8) & 0xFFFFFFFF) != version)
 	{
-		std::copy(h.linkname.begin(), h.linkname.end(), rh.data() + linkname_offset);
+		return mtar_error::BADINDEX;
 	}
-
-	/* Calculate and write checksum */
-	unsigned int chksum = checksum(rh);
-	// use aux array for leading zeros
-	// c-array is more convenient here
-	char aux[6] = { '0', '0', '0', '0', '0', '0' };
-	auto res = std::to_chars(aux, aux + 7, chksum, 8);
-	if (res.ptr == aux + 7) // all 6 elements are used, ptr is 1 past end
+	const std::uint64_t count = get_u64(data.data() + 16);
+	const std::uint64_t names_size = get_u64(data.data() + 24);
+	if (count > (data.size() - header_size) / entry_size ||
+		names_size != data.size() - header_size - count * entry_size)
 	{
-		std::copy(aux, aux + 6, rh.data() + checksum_offset);
+		return mtar_error::BADINDEX;
 	}
-	else
+	/* Load entries */
+	const char* p = data.data() + header_size;
+	entries_.resize(count);
+	for (mtar_index_entry_t& e : entries_)
 	{
-		std::rotate_copy(aux, res.ptr, aux + 6, rh.data() + checksum_offset);
+		e.header_offset = get_u64(p);
+		e.data_offset = get_u64(p + 8);
+		e.size = get_u64(p + 16);
+		e.name_offset = get_u64(p + 24);
+		e.name_size = get_u64(p + 32) & 0xFFFFFFFF;
+		e.type = static_cast<mtar_type>(static_cast<unsigned char>(p[36]));
+		if (e.name_offset > names_size || e.name_size > names_size - e.name_offset)
+		{
+			clear();
+			return mtar_error::BADINDEX;
+		}
+		p += entry_size;
 	}
-	rh[checksum_offset + 7] = ' ';
-
+	/* Load names */
+	names_.assign(p, p + names_size);
+	end_offset = get_u64(data.data() + 32);
+	digest_ = get_u64(data.data() + 40);
+	archive_size_ = get_u64(data.data() + 48);
+	rebuild_lookup();
 	return mtar_error::SUCCESS;
 }
 
-std::string_view mtar_t::strerror(mtar_error err)
+mtar_error mtar_index_t::load(std::istream& is)
 {
-	switch (err)
+	std::vector<char> buf{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+	if (is.bad())
 	{
-	case mtar_error::SUCCESS:
-		return "success";
-	case mtar_error::FAILURE:
-		return "failure";
-	case mtar_error::OPENFAIL:
-		return "could not open";
-	case mtar_error::READFAIL:
-		return "could not read";
-	case mtar_error::WRITEFAIL:
-		return "could not write";
-	case mtar_error::SEEKFAIL:
-		return "could not seek";
-	case mtar_error::BADCHKSUM:
-		return "bad checksum";
-	case mtar_error::NULLRECORD:
-		return "null record";
-	case mtar_error::NOTFOUND:
-		return "file not found";
+		return mtar_error::READFAIL;
 	}
-	return "unknown error";
+	return load(std::string_view(buf.data(), buf.size()));
 }
 
-mtar_t::mtar_t(std::istream& is) : stream{std::ref(is)}
+mtar_error mtar_index_t::validate(mtar_t& tar, bool full) const
 {
-	/* Init tar struct and functions */
-	read_func = [](mtar_t& tar, char* data, size_t size)
+	/* Archive must still have its size, if both the index and the backend know it */
+	const mtar_size_t size = tar.bytes_after(0);
+	if (archive_size_ != 0 && size != mtar_t::unknown_pos && size != archive_size_)
 	{
-		std::get<1>(tar.stream).get().read(data, size);
-		return mtar_error::SUCCESS;
-	};
-	seek_func = [](mtar_t& tar, size_t offset)
+		return mtar_error::BADINDEX;
+	}
+	/* End of archive must be where the index says it is, anything else there was appended */
+	mtar_error err = tar.seek(end_offset);
+	if (err != mtar_error::SUCCESS)
 	{
-		std::get<1>(tar.stream).get().seekg(offset, std::ios::beg);
-		return mtar_error::SUCCESS;
-	};
-}
-
-mtar_t::mtar_t(std::ostream& os) : stream{std::ref(os)}
-{
-	/* Init tar struct and functions */
-	write_func = [](mtar_t& tar, const char* data, size_t size)
+		return err;
+	}
+	mtar_header_view_t h;
+	err = tar.read_header(h);
+	if (err != mtar_error::NULLRECORD)
 	{
-		std::get<2>(tar.stream).get().write(data, size);
-		return mtar_error::SUCCESS;
-	};
-	close_func = [](mtar_t& tar) noexcept
+		return err == mtar_error::SUCCESS || err == mtar_error::BADCHKSUM || err == mtar_error::READFAIL ?
+			mtar_error::BADINDEX : err;
+	}
+	auto matches = [&](const mtar_index_entry_t& e)
 	{
-		std::get<2>(tar.stream).get().flush();
+		return tar.last_header == e.header_offset && tar.read_pos == e.data_offset &&
+			h.size() == e.size && h.type() == e.type && h.name() == name(e);
 	};
-}
 
-mtar_t::mtar_t(std::iostream& ios) : stream{std::ref(ios)}
-{
-	/* Init tar struct and functions */
-	write_func = [](mtar_t& tar, const char* data, size_t size)
+	if (!full)
 	{
-		std::get<3>(tar.stream).get().write(data, size);
+		/* Compare a few headers, find(name, h, index) checks the header of every lookup anyway */
+		const size_t count = std::min(entries_.size(), mtar_index_info::validate_samples);
+		for (size_t k = 0; k < count; k++)
+		{
+			const mtar_index_entry_t& e = entries_[count == 1 ? 0 : k * (entries_.size() - 1) / (count - 1)];
+			err = tar.seek(e.header_offset);
+			if (err != mtar_error::SUCCESS)
+			{
+				return err;
+			}
+			err = tar.read_header(h);
+			if (err != mtar_error::SUCCESS || !matches(e))
+			{
+				return err == mtar_error::SUCCESS || err == mtar_error::BADCHKSUM || err == mtar_error::NULLRECORD ?
+					mtar_error::BADINDEX : err;
+			}
+		}
 		return mtar_error::SUCCESS;
-	};
-	read_func = [](mtar_t& tar, char* data, size_t size)
+	}
+
+	/* Walk all headers, comparing them with the index as we go */
+	err = tar.rewind();
+	if (err != mtar_error::SUCCESS)
 	{
-		std::get<3>(tar.stream).get().read(data, size);
-		return mtar_error::SUCCESS;
-	};
-	seek_func = [](mtar_t& tar, size_t offset)
+		return err;
+	}
+	std::uint64_t digest = 0;
+	size_t i = 0;
+	while ((err = tar.read_header(h)) == mtar_error::SUCCESS)
 	{
-		std::get<3>(tar.stream).get().seekg(offset, std::ios::beg);
-		return mtar_error::SUCCESS;
-	};
-	close_func = [](mtar_t& tar) noexcept
+		if (i == entries_.size() || !matches(entries_[i]))
+		{
+			return mtar_error::BADINDEX;
+		}
+		digest += mtar_index_info::entry_digest(entries_[i], h.name(), h.raw());
+		err = tar.skip_data(h.size());
+		if (err != mtar_error::SUCCESS)
+		{
+			return err;
+		}
+		i++;
+	}
+	if (err != mtar_error::NULLRECORD)
 	{
-		std::get<3>(tar.stream).get().flush();
-	};
-}
-
-mtar_t::~mtar_t()
-{
-	close_func(*this);
-}
-
-mtar_error mtar_t::seek(size_t pos)
-{
-	read_pos = pos;
-	remaining_data = 0; // clear remaining data to prevent read_header, seek, read_data (error)
-	return seek_func(*this, pos);
-}
-
-mtar_error mtar_t::seek_data(ptrdiff_t off)
-{
-	// if remaining_data is 0 (past end by unknown amount or not in data record at all)
-	// or off is more than remaining_data (seeks past data)
-	// or read_pos + off is less than zero
-	// or read_pos + off is less than last_header + mtar_record_size (seeks before data)
-	if (remaining_data == 0 || remaining_data < off || read_pos < -off || read_pos + off < last_header + mtar_record_size)
+		return err == mtar_error::BADCHKSUM ? mtar_error::BADINDEX : err;
+	}
+	/* Headers must match exactly */
+	if (i != entries_.size() || tar.last_header != end_offset || digest != digest_)
 	{
-		return mtar_error::SEEKFAIL;
+		return mtar_error::BADINDEX;
 	}
-	read_pos += off;
-	remaining_data -= off;
-	return seek_func(*this, read_pos);
+	return mtar_error::SUCCESS;
 }
 
-mtar_error mtar_t::rewind()
+#ifdef MTAR_POSIX
+mtar_mmap_t::mtar_mmap_t(mtar_mmap_t&& other) noexcept : data_(other.data_), size_(other.size_)
 {
-	last_header = 0;
-	return seek_func(*this, 0);
+	other.data_ = nullptr;
+	other.size_ = 0;
 }
 
-mtar_error mtar_t::next()
+mtar_mmap_t& mtar_mmap_t::operator=(mtar_mmap_t&& other) noexcept
 {
-	/* Load header */
-	mtar_header_t h;
-	mtar_error err = read_header(h);
-	if (err != mtar_error::SUCCESS)
+	if (this != &other)
 	{
-		return err;
+		close();
+		data_ = other.data_;
+		size_ = other.size_;
+		other.data_ = nullptr;
+		other.size_ = 0;
 	}
-	/* Seek to next record */
-	size_t n = round_up(h.size, mtar_record_size);
-	return seek(read_pos + n);
+	return *this;
 }
 
-mtar_error mtar_t::skip_data(size_t data_size)
+mtar_mmap_t::~mtar_mmap_t()
 {
-	return seek(read_pos + round_up(data_size, mtar_record_size));
+	close();
 }
 
-mtar_error mtar_t::find(std::string_view name, mtar_header_t& h)
+mtar_error mtar_mmap_t::open(const char* path)
 {
-	/* Start at beginning */
-	mtar_error err = rewind();
-	if (err != mtar_error::SUCCESS)
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
 	{
-		return err;
+		return mtar_error::OPENFAIL;
 	}
-	/* Iterate all files until we hit an error or find the file */
-	mtar_header_t header;
-	while ((err = read_header(header)) == mtar_error::SUCCESS)
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return mtar_error::OPENFAIL;
+	}
+	/* Empty files cannot be mapped but are valid (if useless) */
+	if (st.st_size > 0)
 	{
-		if (header.name == name)
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED)
 		{
-			h = header;
-			return mtar_error::SUCCESS;
+			::close(fd);
+			return mtar_error::OPENFAIL;
 		}
-		skip_data(header.size);
+		data_ = static_cast<const char*>(p);
+		size_ = st.st_size;
 	}
-	/* Return error */
-	if (err == mtar_error::NULLRECORD)
+	// mapping stays valid after closing
+	::close(fd);
+	return mtar_error::SUCCESS;
+}
+
+void mtar_mmap_t::close()
+{
+	if (data_ != nullptr)
 	{
-		err = mtar_error::NOTFOUND;
+		munmap(const_cast<char*>(data_), size_);
 	}
-	return err;
+	data_ = nullptr;
+	size_ = 0;
 }
 
-mtar_error mtar_t::peek_header(mtar_header_t& h)
+mtar_error mtar_shared_t::init(mtar_index_t&& index)
 {
-	/* Save header position */
-	last_header = read_pos;
-	/* Read raw header */
-	mtar_raw_header_t rh;
-	mtar_error err = tread(rh.data(), mtar_raw_header_size);
-	if (err != mtar_error::SUCCESS)
+	mtar_t tar(*this);
+	if (index.size() == 0)
 	{
-		return err;
+		return index_.build(tar);
 	}
-	/* Seek back to start of header */
-	err = seek(last_header);
+	// quick check only, a full walk would cost about as much as building the index
+	mtar_error err = index.validate(tar);
 	if (err != mtar_error::SUCCESS)
 	{
 		return err;
 	}
-	/* Load raw header into header struct and return */
-	return raw_to_header(h, rh);
+	index_ = std::move(index);
+	return mtar_error::SUCCESS;
 }
 
-mtar_error mtar_t::read_header(mtar_header_t& h)
+mtar_error mtar_shared_t::open(const char* path, mtar_index_t&& index)
 {
-	/* Save header position */
-	last_header = read_pos;
-	/* Read raw header */
-	mtar_raw_header_t rh;
-	mtar_error err = tread(rh.data(), mtar_raw_header_size);
+	close();
+	mtar_error err = map_.open(path);
 	if (err != mtar_error::SUCCESS)
 	{
 		return err;
 	}
-	/* Load raw header into header struct and return */
-	err = raw_to_header(h, rh);
+	err = init(std::move(index));
 	if (err != mtar_error::SUCCESS)
 	{
-		return err;
+		close();
 	}
-	remaining_data = h.size;
-	return mtar_error::SUCCESS;
+	return err;
 }
 
-mtar_error mtar_t::read_data(char* data, size_t size)
+mtar_error mtar_shared_t::open(int fd, mtar_index_t&& index)
 {
-	/* If we have no remaining data then this is the first read and header is valid
-	 * we consume the header, which sets the remaining data and puts us in the correct place */
-	if (remaining_data == 0)
+	close();
+	/* Readers use pread, which needs a seekable file */
+	if (::lseek(fd, 0, SEEK_CUR) < 0)
 	{
-		/* Read header */
-		mtar_header_t h;
-		mtar_error err = read_header(h);
-		if (err != mtar_error::SUCCESS)
-		{
-			return err;
-		}
+		return mtar_error::SEEKFAIL;
 	}
-	/* Read data */
-	mtar_error err = tread(data, size);
+	fd_ = fd;
+	mtar_error err = init(std::move(index));
 	if (err != mtar_error::SUCCESS)
 	{
-		return err;
-	}
-	remaining_data -= size;
-	/* If there is no remaining data we've finished reading and seek back to the
-	 * header */
-	if (remaining_data == 0)
-	{
-		return seek(last_header);
+		close();
 	}
-	return mtar_error::SUCCESS;
-}
-
-mtar_error mtar_t::write_header(const mtar_header_t& h)
-{
-	/* Build raw header and write */
-	mtar_raw_header_t rh;
-	header_to_raw(rh, h);
-	remaining_data = h.size;
-	return twrite(rh.data(), mtar_raw_header_size);
-}
-
-mtar_error mtar_t::write_file_header(std::string_view name, size_t size)
-{
-	/* Build header */
-	mtar_header_t h;
-	h.name = name;
-	h.size = size;
-	h.type = mtar_type::REG;
-	h.mode = 0664;
-	/* Write header */
-	return write_header(h);
+	return err;
 }
 
-mtar_error mtar_t::write_dir_header(std::string_view name)
+void mtar_shared_t::close()
 {
-	/* Build header */
-	mtar_header_t h;
-	h.name = name;
-	h.type = mtar_type::DIR;
-	h.mode = 0775;
-	/* Write header */
-	return write_header(h);
+	map_.close();
+	fd_ = -1;
+	index_.clear();
 }
+#endif
 
-mtar_error mtar_t::write_data(const char* data, size_t size)
+mtar_source_t mtar_source_t::file(std::string_view name, const std::filesystem::path& path)
 {
-	/* Write data */
-	mtar_error err = twrite(data, size);
-	if (err != mtar_error::SUCCESS)
-	{
-		return err;
-	}
-	remaining_data -= size;
-	/* Write padding if we've written all the data for this file */
-	if (remaining_data == 0)
+	mtar_source_t src;
+	src.header.name = name;
+	std::error_code ec;
+	// a missing file fails when it is opened for writing
+	src.header.size = std::filesystem::file_size(path, ec);
+	if (ec)
 	{
-		return write_null_bytes(round_up(write_pos, mtar_record_size) - write_pos);
+		src.header.size = 0;
 	}
-	return mtar_error::SUCCESS;
+	src.path = path;
+	return src;
 }
 
-mtar_error mtar_t::finalize()
+mtar_source_t mtar_source_t::memory(std::string_view name, std::string_view data)
 {
-	/* Write two NULL records */
-	return write_null_bytes(mtar_record_size * 2);
+	mtar_source_t src;
+	src.header.name = name;
+	src.header.size = data.size();
+	src.data = data;
+	return src;
 }
@@ -10,18 +10,29 @@
 
 #include <array>
 #include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #define MTAR_VERSION "0.1.0"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MTAR_POSIX 1
+#endif
+
 using std::size_t;
 using std::ptrdiff_t;
 
+// archive positions and entry sizes, 64 bit on all platforms
+using mtar_size_t = std::uint64_t;
+
 enum class mtar_error
 {
 	SUCCESS = 0,
@@ -32,7 +43,8 @@ enum class mtar_error
 	SEEKFAIL = -5,
 	BADCHKSUM = -6,
 	NULLRECORD = -7,
-	NOTFOUND = -8
+	NOTFOUND = -8,
+	BADINDEX = -9
 };
 
 enum class mtar_type : unsigned int
@@ -43,15 +55,17 @@ enum class mtar_type : unsigned int
 	CHR = '3', // character device
 	BLK = '4', // block device
 	DIR = '5', // directory
-	FIFO = '6' // named pipe
+	FIFO = '6', // named pipe
+	PAX = 'x', // pax extended header for the next entry (not returned by read_header)
+	PAX_GLOBAL = 'g' // pax global header (not returned by read_header)
 };
 
 struct mtar_header_t
 {
-	unsigned mode = 0664; // posix mode (read/write/execute)
-	unsigned owner = 0; // owner of file
-	unsigned size = 0; // size of file (in bytes)
-	unsigned mtime = 0; // unix timestamp when file was last modified
+	std::uint64_t mode = 0664; // posix mode (read/write/execute)
+	std::uint64_t owner = 0; // owner of file, base-256 fields can hold more than 32 bits
+	mtar_size_t size = 0; // size of file (in bytes)
+	std::uint64_t mtime = 0; // unix timestamp when file was last modified
 	mtar_type type = mtar_type::REG; // type of file
 	std::string name; // filename
 	std::string linkname; // name of link destination
@@ -59,78 +73,603 @@ struct mtar_header_t
 
 using mtar_raw_header_t = std::array<char, 512>;
 
+// data source for an archive entry
+struct mtar_source_t
+{
+	mtar_header_t header; // header of entry, size must match the data
+	std::filesystem::path path; // file to read data from
+	std::string_view data; // data in memory, used if path is empty
+
+	// regular file entry with data read from path
+	static mtar_source_t file(std::string_view name, const std::filesystem::path& path);
+	// regular file entry with data in memory, which must outlive the source
+	static mtar_source_t memory(std::string_view name, std::string_view data);
+};
+
+// non-owning view of an archive header, numeric fields are decoded when accessed
+// points into the header cache of mtar_t (or into the archive for memory backends),
+// so it is only valid until the next header is read or the archive is written
+class mtar_header_view_t
+{
+private:
+	friend class mtar_t;
+	const char* raw_ = nullptr;
+	mtar_size_t size_ = 0;
+	std::string_view name_;
+	std::string_view linkname_;
+
+public:
+	// fields that can't be decoded are returned as 0
+	std::uint64_t mode() const;
+	std::uint64_t owner() const;
+	mtar_size_t size() const { return size_; }
+	std::uint64_t mtime() const;
+	mtar_type type() const;
+	std::string_view name() const { return name_; }
+	std::string_view linkname() const { return linkname_; }
+	// raw ustar header record
+	const char* raw() const { return raw_; }
+	// copy into header, fails if a numeric field can't be decoded
+	mtar_error to_header(mtar_header_t& h) const;
+};
+
+struct mtar_index_entry_t;
+class mtar_index_t;
+class mtar_entry_t;
+class mtar_entries_t;
+class mtar_shared_t;
+class mtar_select_t;
+
+// latency histogram, bucket i counts durations in [2^i, 2^(i+1)) ns (bucket 0 also counts 0 and 1 ns)
+struct mtar_histogram_t
+{
+	static constexpr size_t buckets = 40; // the last bucket holds everything from ~9 minutes
+	std::array<std::uint64_t, buckets> counts{};
+	std::uint64_t count = 0; // number of durations
+	std::uint64_t total_ns = 0; // sum of durations
+
+	void add(std::uint64_t ns);
+	// upper bound of the bucket containing the given fraction (0 to 1) of durations, in ns
+	std::uint64_t percentile(double p) const;
+};
+
+// counters of backend calls
+// nothing is counted if MTAR_NO_STATS is defined, which also removes timing and tracing
+struct mtar_stats_t
+{
+	size_t reads = 0; // read calls
+	std::uint64_t read_bytes = 0; // bytes read
+	size_t writes = 0; // write calls
+	std::uint64_t write_bytes = 0; // bytes written
+	size_t seeks = 0; // seek calls
+	size_t header_reads = 0; // headers read from the backend
+	size_t header_cache_hits = 0; // headers reused without reading
+	size_t headers_parsed = 0; // headers parsed, including pax headers
+	size_t checksum_failures = 0; // headers with a bad checksum
+	// time spent in backend calls, only measured if mtar_t::timing is set or a trace function is used
+	mtar_histogram_t read_latency;
+	mtar_histogram_t write_latency;
+	mtar_histogram_t seek_latency;
+};
+
+enum class mtar_io_kind
+{
+	READ,
+	WRITE,
+	SEEK
+};
+
+// backend call passed to mtar_t::trace
+struct mtar_io_event_t
+{
+	mtar_io_kind kind;
+	mtar_size_t pos; // archive position of the data, or target of the seek
+	size_t size; // bytes read or written, 0 for seeks
+	std::uint64_t ns; // time spent in the backend
+	mtar_error result;
+};
+
+#ifdef MTAR_POSIX
+// read-only memory mapping of a file
+class mtar_mmap_t
+{
+private:
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+
+public:
+	mtar_mmap_t() = default;
+	mtar_mmap_t(const mtar_mmap_t&) = delete;
+	mtar_mmap_t(mtar_mmap_t&& other) noexcept;
+	mtar_mmap_t& operator=(const mtar_mmap_t&) = delete;
+	mtar_mmap_t& operator=(mtar_mmap_t&& other) noexcept;
+	~mtar_mmap_t();
+
+	// map file, replacing any existing mapping
+	mtar_error open(const char* path);
+	// unmap file
+	void close();
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+};
+#endif
+
 class mtar_t
 {
 private:
+	friend class mtar_entry_t;
+	friend class mtar_entries_t;
+	friend class mtar_index_t;
+
 	std::function<mtar_error(mtar_t&, char*, size_t)> read_func;
 	std::function<mtar_error(mtar_t&, const char*, size_t)> write_func;
-	std::function<mtar_error(mtar_t&, size_t)> seek_func;
+	std::function<mtar_error(mtar_t&, mtar_size_t)> seek_func;
 	std::function<void(mtar_t&)> close_func = [](mtar_t& tar) noexcept {};
 
+	// built-in backends are called directly, only CUSTOM goes through the callbacks above
+	enum class backend_t
+	{
+		CUSTOM,
+		STREAM,
+		MEMORY,
+		FD
+	};
+	backend_t backend = backend_t::CUSTOM;
+	// file descriptor of FD backend, accessed with pread/pwrite unless it is a pipe or socket
+	int fd = -1;
+	bool fd_positional = false;
+	// reject writes, for readers of a shared archive
+	bool read_only = false;
+	// streams of STREAM backend, either may be null
+	std::istream* in = nullptr;
+	std::ostream* out = nullptr;
+
 	static constexpr size_t NULL_BLOCKSIZE = 4096;
 	static constexpr char null_block[NULL_BLOCKSIZE]{};
 
-	static size_t round_up(size_t n, size_t incr);
-	static unsigned int checksum(const mtar_raw_header_t& rh);
+	// archive contents, if reading directly from memory
+	const char* mem_data = nullptr;
+	size_t mem_size = 0;
+
+	// position of the backend, seeking is deferred until a read needs it
+	static constexpr mtar_size_t unknown_pos = UINT64_MAX;
+	mtar_size_t io_pos = 0;
+	// last header read from the backend, so it is never read twice in a row
+	// (e.g. peek_header followed by read_header, or read_data seeking back to the header)
+	mtar_raw_header_t cached_header;
+	mtar_size_t cached_header_pos = 0;
+	bool header_cached = false;
+	// last header that used pax extended headers, kept since it spans several records
+	mtar_raw_header_t ext_raw;
+	mtar_size_t ext_size = 0;
+	std::string ext_name;
+	std::string ext_linkname;
+	mtar_size_t ext_header_pos = unknown_pos;
+	mtar_size_t ext_data_start = 0;
+	// data of pax extended header being read
+	// the size comes from the archive, so larger extended headers are rejected instead of allocated
+	static constexpr size_t max_pax_size = 1 << 20;
+	std::string pax_buffer;
+	// position of the data of the current entry
+	mtar_size_t data_start = 0;
+	// position of the header following the current entry
+	mtar_size_t next_header = 0;
+	// header at last_header was read, so next() goes on to next_header (cleared by seek)
+	bool header_consumed = false;
+	// scratch space for skipping data in forward-only mode
+	std::vector<char> skip_buffer;
+	// writes are collected into blocks of write_block_size bytes, 0 writes directly
+	size_t write_block_size = 10240;
+	std::vector<char> write_buffer;
+	size_t write_buffered = 0;
+
+	static mtar_size_t round_up(mtar_size_t n, mtar_size_t incr);
+	// backend dispatch, these do not update positions but count calls in stats
+	mtar_error io_read(char* data, size_t size);
+	// pos is the archive position of the data, only used by positional backends
+	mtar_error io_write(mtar_size_t pos, const char* data, size_t size);
+	// write two buffers back to back, in a single call (writev) for file descriptors
+	mtar_error io_write(mtar_size_t pos, const char* data1, size_t size1, const char* data2, size_t size2);
+	mtar_error io_seek(mtar_size_t pos);
+	// count backend call f in stats, measuring it if timing or tracing
+	template<typename F>
+	mtar_error instrument(mtar_io_kind kind, mtar_size_t pos, size_t size, F&& f);
+	// seek backend, reads and discards in forward-only mode
+	mtar_error tseek(mtar_size_t pos);
 	mtar_error tread(char* data, size_t size);
 	mtar_error twrite(const char* data, size_t size);
 	mtar_error write_null_bytes(size_t n);
-	static mtar_error raw_to_header(mtar_header_t& h, const mtar_raw_header_t& rh);
+	// pass buffered writes to the backend
+	mtar_error flush_write_buffer();
+	// read header, rh points into memory for memory backends and to the header cache otherwise
+	mtar_error tread_header(const char*& rh);
+	// whether read_at can be called concurrently
+	bool positional_read() const;
+	// read at position, changes read position unless positional_read() is true
+	mtar_error read_at(mtar_size_t pos, char* data, size_t size);
+	// output stream, if writing to a stream
+	std::ostream* output_stream();
+	// bytes of the archive after pos, or unknown_pos if the backend doesn't know its size
+	mtar_size_t bytes_after(mtar_size_t pos) const;
+	// whether write_at can be called concurrently
+	bool positional_write() const;
+	// write at position, only supported by seekable outputs
+	// does not change write_pos, but changes the output position unless positional_write() is true
+	mtar_error write_at(mtar_size_t pos, const char* data, size_t size);
+	// continue writing at pos, where the end of archive records are
+	mtar_error set_append_pos(mtar_size_t pos);
+	// turn size bytes (whole records) at pos into global headers that readers skip
+	mtar_error write_tombstone(mtar_size_t pos, mtar_size_t size);
+	// write buffered data before writing at other positions, and continue at write_pos after
+	mtar_error begin_update();
+	mtar_error end_update();
+	// check for null record and valid checksum
+	static mtar_error check_header(const char* rh);
+	static mtar_error raw_to_view(mtar_header_view_t& h, const char* rh);
+	static mtar_error raw_to_header(mtar_header_t& h, const char* rh);
 	static mtar_error header_to_raw(mtar_raw_header_t& rh, const mtar_header_t& h);
+	// pax records for fields that don't fit in a ustar header, empty if none are needed
+	static std::string pax_records(const mtar_header_t& h);
+	// append pax extended header record and data for h, if needed
+	static void encode_pax_header(std::string& out, const mtar_header_t& h, std::string_view records);
+	// position after all data of the current entry was read
+	// back at the header, or at the next header in forward-only mode
+	mtar_error seek_after_data();
+	// size of all header records for h
+	static mtar_size_t header_size(const mtar_header_t& h);
+	// position reader for a scan over the archive
+	// from the beginning, or after the current entry in forward-only mode
+	mtar_error scan_start();
 
 
 public:
 	mtar_t(std::istream& is);
 	mtar_t(std::ostream& os);
 	mtar_t(std::iostream& ios);
+	// read directly from memory owned by the caller (e.g. a received buffer), which must outlive mtar_t
+	// headers are parsed in place and data can be accessed without copying, see read_data_view
+	mtar_t(const char* data, size_t size);
+#ifdef MTAR_POSIX
+	// read directly from mapped file, map must outlive mtar_t
+	mtar_t(const mtar_mmap_t& map);
+	// read and write file descriptor directly, using positional I/O if it is seekable
+	// positions are relative to the start of the file, not the current offset
+	// the descriptor is not closed, and is set to forward_only if it is not seekable
+	explicit mtar_t(int fd_);
+	// read-only reader of a shared archive, which must outlive mtar_t
+	// readers of the same archive can be used from different threads at once
+	explicit mtar_t(const mtar_shared_t& archive);
+#endif
 	mtar_t(std::function<mtar_error(mtar_t&, char*, size_t)> read_func_,
 		std::function<mtar_error(mtar_t&, const char*, size_t)> write_func_,
-		std::function<mtar_error(mtar_t&, size_t)> seek_func_,
+		std::function<mtar_error(mtar_t&, mtar_size_t)> seek_func_,
 		std::function<void(mtar_t&)> close_func_) :
-		read_func(read_func_), write_func(write_func_), seek_func(seek_func_), close_func(close_func_) {}
+		read_func(std::move(read_func_)), write_func(std::move(write_func_)),
+		seek_func(std::move(seek_func_)), close_func(std::move(close_func_)), forward_only(!seek_func) {}
 	~mtar_t();
 
+	// never seek backwards, for non-seekable inputs such as pipes and sockets
+	// data is skipped by reading it, rewind, find from the start and negative seek_data are not possible,
+	// and read_data continues to the next header instead of seeking back once an entry is consumed
+	// set automatically if no seek function is given
+	bool forward_only = false;
+
 	std::variant<std::monostate,
 		std::reference_wrapper<std::istream>,
 		std::reference_wrapper<std::ostream>,
 		std::reference_wrapper<std::iostream>> stream;
-	size_t read_pos = 0;
-	size_t write_pos = 0;
-	size_t remaining_data = 0;
-	size_t last_header = 0;
+	mtar_size_t read_pos = 0;
+	mtar_size_t write_pos = 0;
+	mtar_size_t remaining_data = 0;
+	mtar_size_t last_header = 0;
+	mtar_stats_t stats;
+	// measure latency of backend calls into stats
+	bool timing = false;
+	// called after every backend call, e.g. to forward them to a metrics system (also measures latency)
+	std::function<void(const mtar_io_event_t&)> trace;
 
 	// get error message
 	static std::string_view strerror(mtar_error err);
+	// compute checksum of raw header (uses SIMD if available)
+	static unsigned int checksum(const char* rh);
+	// check count contiguous raw headers, results[i] is SUCCESS, NULLRECORD or BADCHKSUM
+	// with AVX2 the checksums of four headers are computed together
+	// returns number of valid headers
+	static size_t validate_headers(const char* data, size_t count, mtar_error* results);
+	// exact size of an archive of the given entries, including padding and the two end records
+	static mtar_size_t archive_size(const std::vector<mtar_source_t>& sources);
+	// build a complete archive of the given entries in out, size must be archive_size(sources)
+	// headers and padding are written in place and data is copied (or read from files) straight into out
+	static mtar_error build(const std::vector<mtar_source_t>& sources, char* out, size_t size);
+	// build into out, which is allocated once with the exact size (returned in size) and not zero filled first
+	static mtar_error build(const std::vector<mtar_source_t>& sources, std::unique_ptr<char[]>& out, size_t& size);
 
 	// seek READ, does not affect write
-	mtar_error seek(size_t pos);
+	// the backend is only seeked once data is read at a different position
+	mtar_error seek(mtar_size_t pos);
 	// seek read within a data section only, using OFFSET (unlike seek)
-	mtar_error seek_data(ptrdiff_t off);
+	mtar_error seek_data(std::int64_t off);
 	// rewind reading to beginning of file
+	// also forces the backend to be seeked, in case the stream was used directly
 	mtar_error rewind();
 	// skip to next record (file + data)
+	// if the current header was already consumed (read_header, find), skips the rest of its data
+	// after seek or skip_data, skips the entry at the new position
 	mtar_error next();
 	// skip over data section, if header is already read
-	mtar_error skip_data(size_t data_size);
+	mtar_error skip_data(mtar_size_t data_size);
 	// find entry in archive
 	mtar_error find(std::string_view name, mtar_header_t& h);
+	// find entry using an index, reads only the matching header
+	// returns BADINDEX if the header found there is not the entry (the index is stale)
+	mtar_error find(std::string_view name, mtar_header_t& h, const mtar_index_t& index);
+	// position reader at the data of an indexed entry without reading its header
+	mtar_error open_entry(const mtar_index_entry_t& e);
+	// open_entry by name, using an index
+	mtar_error open_entry(std::string_view name, const mtar_index_t& index);
 	// read header and seek back to original position
 	mtar_error peek_header(mtar_header_t& h);
+	// peek_header without copying, see mtar_header_view_t for lifetime
+	mtar_error peek_header(mtar_header_view_t& h);
 	// read and consume header
+	// pax extended headers are applied (size, path, linkpath) and global headers are skipped,
+	// last_header is the position of the first header belonging to the entry
 	mtar_error read_header(mtar_header_t& h);
+	// read_header without copying the name or allocating, see mtar_header_view_t for lifetime
+	mtar_error read_header(mtar_header_view_t& h);
 	// read and consume data
 	mtar_error read_data(char* ptr, size_t size);
+	// read and consume data without copying, only supported when reading from memory
+	// data points into the archive memory
+	mtar_error read_data_view(std::string_view& data, size_t size);
+
+	// range over all entries, see mtar_entries_t
+	mtar_entries_t entries();
+
+	// extract indexed entries below dest using multiple threads (0 for hardware concurrency)
+	// only the given names are extracted, or all entries if names is empty
+	// directories are created before any file is written, links after all files
+	// fails for paths or link targets outside of dest and paths through existing symlinks
+	// reading position is unspecified afterwards
+	mtar_error extract(const std::filesystem::path& dest, const mtar_index_t& index,
+		const std::vector<std::string_view>& names = {}, unsigned threads = 0);
+	// index archive and extract all entries below dest
+	mtar_error extract_all(const std::filesystem::path& dest, unsigned threads = 0);
+	// call sink for every entry whose name is selected, in a single pass from the beginning
+	// (after the current entry in forward-only mode), sink can read the data of the entry
+	// stops at the first error returned by sink
+	mtar_error extract_matching(const mtar_select_t& select, const std::function<mtar_error(mtar_entry_t&)>& sink);
+	// extract_matching using an index, only headers of selected entries are read (in archive order)
+	mtar_error extract_matching(const mtar_select_t& select, const std::function<mtar_error(mtar_entry_t&)>& sink,
+		const mtar_index_t& index);
+#ifdef MTAR_POSIX
+	// write data of an indexed entry to dst at its current offset
+	// with a file descriptor backend the data is copied in the kernel (copy_file_range, sendfile or splice)
+	// reading position is unspecified afterwards
+	mtar_error extract_to_fd(const mtar_index_entry_t& e, int dst);
+#endif
 
 	// write custom header data
+	// a pax extended header is written first if the size (8 GiB or more), name or linkname don't fit
 	mtar_error write_header(const mtar_header_t& h);
 	// write header data for file entry
-	mtar_error write_file_header(std::string_view name, size_t size);
+	mtar_error write_file_header(std::string_view name, mtar_size_t size);
 	// write header data for directory entry
 	mtar_error write_dir_header(std::string_view name);
 	// write file data (not header)
 	mtar_error write_data(const char* data, size_t size);
-	// mark end of archive
+#ifdef MTAR_POSIX
+	// write file entry with size bytes read from src at its current offset, including padding
+	// with a file descriptor backend the data is copied in the kernel (copy_file_range, sendfile or splice)
+	mtar_error write_file_from_fd(std::string_view name, int src, mtar_size_t size);
+#endif
+	// write entries using multiple threads (0 for hardware concurrency), output must be seekable
+	// the layout of all entries is computed first, then each entry is written at its own offset
+	// a stream that can't seek past its end is filled with zeros up to the final size first
+	// write position is placed after the last entry, finalize still needs to be called
+	mtar_error write_parallel(const std::vector<mtar_source_t>& sources, unsigned threads = 0);
+	// open an existing archive for appending, the output must be seekable (stream or file descriptor)
+	// write position is placed at the end of archive records, new entries and finalize overwrite them
+	// headers are read from the beginning to find the end, data is skipped without reading it
+	mtar_error open_append();
+	// open_append at the end recorded in an index, which must match the archive (BADINDEX otherwise)
+	mtar_error open_append(const mtar_index_t& index);
+	// replace data of an indexed entry in place, if it fits in the records of the old data
+	// only the size in the header is changed, records that are no longer used become a tombstone
+	// (or the new end of the archive if it is the last entry)
+	// returns FAILURE if it doesn't fit or the size is in a pax record (remove and append the entry instead)
+	// the index is updated
+	mtar_error replace(std::string_view name, const char* data, size_t size, mtar_index_t& index);
+	// delete an indexed entry without moving data, and remove it from the index
+	// its headers are overwritten with a tombstone, a pax global header that readers skip
+	// removing the last entry moves the end of the archive instead
+	mtar_error remove(std::string_view name, mtar_index_t& index);
+	// copy all entries to out in a single pass and finalize it, reclaiming space of tombstones
+	// global headers are not copied
+	mtar_error compact(mtar_t& out);
+	// mark end of archive, also writes out buffered data
 	mtar_error finalize();
+	// write out buffered data and flush the output stream
+	mtar_error flush();
+	// size of blocks passed to the backend when writing, buffered data is written out first
+	// the default is 10 KiB (20 records, same as tar), 0 disables buffering
+	// the buffer is also written out by finalize, flush, reads, write_parallel and the destructor
+	mtar_error set_block_size(size_t size);
+};
+
+// entry of mtar_entries_t, data is only read when requested
+// valid until the iterator is advanced, unread data is skipped without reading it
+class mtar_entry_t
+{
+private:
+	friend class mtar_t;
+	friend class mtar_entries_t;
+	mtar_t* tar = nullptr;
+	mtar_header_view_t header_;
+
+public:
+	const mtar_header_view_t& header() const { return header_; }
+	// data not read yet
+	mtar_size_t remaining() const;
+	// read next part of data
+	mtar_error read(char* data, size_t size);
+	// read next part of data without copying, only supported when reading from memory
+	// data points into the archive memory
+	mtar_error read_view(std::string_view& data, size_t size);
+	// pass the rest of the data to sink in chunks, stops at the first error returned by sink
+	// data is passed without copying when reading from memory
+	mtar_error stream(const std::function<mtar_error(const char*, size_t)>& sink);
+};
+
+// input range over the entries of an archive
+// iteration starts at the beginning, or after the current entry in forward-only mode,
+// and ends at the end of the archive or at the first error
+class mtar_entries_t
+{
+private:
+	mtar_t* tar;
+	mtar_entry_t entry;
+	mtar_error error_ = mtar_error::SUCCESS;
+
+	// read next header, false at the end or on error
+	bool read_next();
+
+public:
+	class iterator
+	{
+	private:
+		mtar_entries_t* range = nullptr;
+
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = mtar_entry_t;
+		using difference_type = std::ptrdiff_t;
+		using pointer = mtar_entry_t*;
+		using reference = mtar_entry_t&;
+
+		iterator() = default;
+		explicit iterator(mtar_entries_t* range_) : range(range_) {}
+
+		reference operator*() const { return range->entry; }
+		pointer operator->() const { return &range->entry; }
+		iterator& operator++();
+		void operator++(int) { ++*this; }
+		bool operator==(const iterator& other) const { return range == other.range; }
+		bool operator!=(const iterator& other) const { return range != other.range; }
+	};
+
+	explicit mtar_entries_t(mtar_t& tar_) : tar(&tar_) { entry.tar = tar; }
+
+	iterator begin();
+	iterator end() { return iterator(); }
+	// error that ended iteration, SUCCESS if the end of the archive was reached
+	mtar_error error() const { return error_; }
+};
+
+// names, prefixes and glob patterns selecting entries
+// globs support *, ?, [...] (negated with ! or ^) and backslash escapes, * and ? also match /
+class mtar_select_t
+{
+private:
+	std::vector<std::string> names_; // sorted
+	std::vector<std::string> prefixes_;
+	std::vector<std::string> globs_;
+
+public:
+	mtar_select_t& name(std::string_view n);
+	mtar_select_t& prefix(std::string_view p);
+	mtar_select_t& glob(std::string_view g);
+	bool empty() const { return names_.empty() && prefixes_.empty() && globs_.empty(); }
+	bool matches(std::string_view name) const;
 };
 
+struct mtar_index_entry_t
+{
+	mtar_size_t header_offset = 0; // position of header
+	mtar_size_t data_offset = 0; // position of data
+	mtar_size_t size = 0; // size of data (in bytes)
+	mtar_type type = mtar_type::REG; // type of file
+	size_t name_offset = 0; // position of name in index name storage
+	size_t name_size = 0; // length of name
+};
+
+// name -> entry map of an archive, built in a single pass
+// not copyable since lookup keys point into the name storage
+class mtar_index_t
+{
+private:
+	friend class mtar_t;
+	std::vector<mtar_index_entry_t> entries_;
+	std::vector<char> names_;
+	std::unordered_map<std::string_view, size_t> lookup_;
+
+	// digest of every header, to tell whether the index still matches the archive
+	std::uint64_t digest_ = 0;
+	// size of the archive when it was indexed, 0 if the backend didn't know it
+	mtar_size_t archive_size_ = 0;
+
+	void rebuild_lookup();
+
+public:
+	mtar_index_t() = default;
+	mtar_index_t(const mtar_index_t&) = delete;
+	mtar_index_t(mtar_index_t&&) = default;
+	mtar_index_t& operator=(const mtar_index_t&) = delete;
+	mtar_index_t& operator=(mtar_index_t&&) = default;
+
+	// position of end of archive (first null record)
+	mtar_size_t end_offset = 0;
+
+	// index all entries of archive, starting from the beginning
+	// reading position is left at the end of the archive
+	mtar_error build(mtar_t& tar);
+	// remove all entries
+	void clear();
+	// find entry by name, nullptr if not found
+	// if a name occurs multiple times, the first entry is used (same as mtar_t::find)
+	const mtar_index_entry_t* find(std::string_view name) const;
+	// get name of entry
+	std::string_view name(const mtar_index_entry_t& e) const;
+	// all entries, in archive order
+	const std::vector<mtar_index_entry_t>& entries() const { return entries_; }
+	size_t size() const { return entries_.size(); }
+
+	// write index in on-disk format (e.g. to a sidecar file `archive.tar.idx`)
+	mtar_error save(std::ostream& os) const;
+	// load index in on-disk format, data is copied (e.g. from a memory mapped file)
+	mtar_error load(std::string_view data);
+	// load index in on-disk format from stream
+	mtar_error load(std::istream& is);
+	// check that the index matches the archive, returns BADINDEX if it is stale
+	// checks the archive size, the end of archive and a few sampled headers
+	// with full, every header is read (data is skipped) and compared with a digest taken by build
+	mtar_error validate(mtar_t& tar, bool full = false) const;
+};
+
+#ifdef MTAR_POSIX
+// archive that is read from many threads at once without locks
+// entries are located with an index and read positionally from a memory mapping or
+// file descriptor, each thread reads through its own mtar_t created from the archive
+class mtar_shared_t
+{
+private:
+	friend class mtar_t;
+	mtar_mmap_t map_;
+	int fd_ = -1;
+	mtar_index_t index_;
+
+	// use given index after a quick validate, or build one if it is empty
+	mtar_error init(mtar_index_t&& index);
+
+public:
+	// map file and index it, or use an index loaded before (e.g. from a sidecar file)
+	mtar_error open(const char* path, mtar_index_t&& index = {});
+	// read seekable file descriptor, which must stay open, and index it or use the given index
+	mtar_error open(int fd, mtar_index_t&& index = {});
+	// unmap file and clear index
+	void close();
+	const mtar_index_t& index() const { return index_; }
+};
+#endif
+
 #endif
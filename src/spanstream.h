@@ -0,0 +1,146 @@
+#ifndef MICROTAR_SPANSTREAM_H
+#define MICROTAR_SPANSTREAM_H
+
+#include <cstddef>
+#include <ios>
+#include <istream>
+#include <streambuf>
+#include <string_view>
+
+namespace mtar
+{
+	// read-only stream buffer over memory owned by the caller, nothing is copied
+	// the memory must outlive the buffer
+	template<typename CharT, typename Traits = std::char_traits<CharT>>
+	class basic_spanbuf : public std::basic_streambuf<CharT, Traits>
+	{
+	private:
+		using base = std::basic_streambuf<CharT, Traits>;
+
+	public:
+		using char_type = typename base::char_type;
+		using traits_type = typename base::traits_type;
+		using int_type = typename base::int_type;
+		using pos_type = typename base::pos_type;
+		using off_type = typename base::off_type;
+
+		basic_spanbuf() {}
+		basic_spanbuf(const CharT* data, std::size_t size)
+		{
+			span(data, size);
+		}
+		basic_spanbuf(std::basic_string_view<CharT, Traits> sv) : basic_spanbuf(sv.data(), sv.size()) {}
+
+		// replace the memory, the read position is reset to the beginning
+		void span(const CharT* data, std::size_t size)
+		{
+			// the get area is never written to, see pbackfail
+			CharT* p = const_cast<CharT*>(data);
+			setg(p, p, p + size);
+		}
+
+		std::basic_string_view<CharT, Traits> view() const
+		{
+			return { this->eback(), size() };
+		}
+
+		std::size_t size() const
+		{
+			return this->egptr() - this->eback();
+		}
+
+	protected:
+		using std::basic_streambuf<CharT, Traits>::setg;
+
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) override
+		{
+			if ((which & std::ios_base::in) != std::ios_base::in)
+			{
+				return -1;
+			}
+			off_type from = 0;
+			if (dir == std::ios_base::cur)
+			{
+				from = this->gptr() - this->eback();
+			}
+			else if (dir == std::ios_base::end)
+			{
+				from = size();
+			}
+			// out of range
+			if ((off < 0 && from < -off) || (off > 0 && off > off_type(size()) - from))
+			{
+				return -1;
+			}
+			setg(this->eback(), this->eback() + (from + off), this->egptr());
+			return from + off;
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) override
+		{
+			return seekoff(off_type(pos), std::ios_base::beg, which);
+		}
+
+		virtual std::streamsize showmanyc() override
+		{
+			const std::streamsize num = this->egptr() - this->gptr();
+			if (num == 0)
+			{
+				return -1;
+			}
+			return num;
+		}
+
+		// the whole span is the get area, so this is only called at the end
+		virtual int_type underflow() override
+		{
+			return Traits::eof();
+		}
+
+		// putting back a different character would write to the caller's memory, so it always fails
+		virtual int_type pbackfail(int_type ch = Traits::eof()) override
+		{
+			if (Traits::eq_int_type(ch, Traits::eof()) && this->gptr() != this->eback())
+			{
+				this->gbump(-1);
+				return Traits::not_eof(ch);
+			}
+			return Traits::eof();
+		}
+	};
+
+	template<typename CharT, typename Traits = std::char_traits<CharT>>
+	class basic_ispanstream : public std::basic_istream<CharT, Traits>
+	{
+	private:
+		using base = std::basic_istream<CharT, Traits>;
+		using spanbuf = basic_spanbuf<CharT, Traits>;
+		// buffer owned by the stream, base only stores the pointer
+		spanbuf buf;
+
+	public:
+		basic_ispanstream(const CharT* data, std::size_t size) : base(&buf), buf(data, size) {}
+		basic_ispanstream(std::basic_string_view<CharT, Traits> sv) : base(&buf), buf(sv) {}
+
+		void span(const CharT* data, std::size_t size)
+		{
+			buf.span(data, size);
+			this->clear();
+		}
+
+		std::basic_string_view<CharT, Traits> view() const
+		{
+			return buf.view();
+		}
+
+		std::size_t size() const
+		{
+			return buf.size();
+		}
+	};
+
+	using spanbuf = basic_spanbuf<char>;
+	using ispanstream = basic_ispanstream<char>;
+}
+
+#endif
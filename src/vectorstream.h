@@ -1,3 +1,6 @@
+#ifndef MICROTAR_VECTORSTREAM_H
+#define MICROTAR_VECTORSTREAM_H
+
 #include <algorithm>
 #include <initializer_list>
 #include <iterator>
@@ -24,27 +27,59 @@ namespace mtar
 		basic_vectorbuf() {}
 		basic_vectorbuf(const Allocator& alloc) : v(alloc) {}
 		template<typename InputIt>
-		basic_vectorbuf(InputIt first, InputIt last, const Allocator& alloc = Allocator()) : v(first, last, alloc) {}
-		basic_vectorbuf(const std::vector<CharT, Allocator>& v_) : v(v_, alloc) {}
-		basic_vectorbuf(const std::vector<CharT, Allocator>& v_, const Allocator& alloc) : v(v_, alloc) {}
-		basic_vectorbuf(std::vector<CharT, Allocator>&& v_) : v(std::move(v_)) {}
-		basic_vectorbuf(std::vector<CharT, Allocator>&& v_, const Allocator& alloc) : v(std::move(v_), alloc) {}
-		basic_vectorbuf(std::initializer_list<CharT> init, const Allocator& alloc = Allocator()) : v(init, alloc) {}
+		basic_vectorbuf(InputIt first, InputIt last, const Allocator& alloc = Allocator()) : v(first, last, alloc)
+		{
+			set_get(0);
+		}
+		basic_vectorbuf(const std::vector<CharT, Allocator>& v_) : v(v_)
+		{
+			set_get(0);
+		}
+		basic_vectorbuf(const std::vector<CharT, Allocator>& v_, const Allocator& alloc) : v(v_, alloc)
+		{
+			set_get(0);
+		}
+		basic_vectorbuf(std::vector<CharT, Allocator>&& v_) : v(std::move(v_))
+		{
+			set_get(0);
+		}
+		basic_vectorbuf(std::vector<CharT, Allocator>&& v_, const Allocator& alloc) : v(std::move(v_), alloc)
+		{
+			set_get(0);
+		}
+		basic_vectorbuf(std::initializer_list<CharT> init, const Allocator& alloc = Allocator()) : v(init, alloc)
+		{
+			set_get(0);
+		}
 
 		std::vector<CharT, Allocator> vec_copy() const
 		{
-			return { v.begin(), v.begin() + v_size };
+			return v;
 		}
 
 		// note: this view will no longer be valid after reallocation
 		std::basic_string_view<CharT, Traits> view() const
 		{
-			return { v.begin(), v.begin() + v_size };
+			return { v.data(), v.size() };
 		}
 
 		std::size_t size() const
 		{
-			return v_size;
+			return v.size();
+		}
+
+		std::size_t capacity() const
+		{
+			return v.capacity();
+		}
+
+		// allocate for at least n characters, so writing up to n characters never reallocates
+		// memory beyond the written size is not initialized
+		void reserve(std::size_t n)
+		{
+			const std::size_t in = pos_in();
+			v.reserve(n);
+			set_get(in);
 		}
 
 		const CharT& operator[](std::size_t pos) const
@@ -59,89 +94,80 @@ namespace mtar
 
 		auto end()
 		{
-			return v.begin() + v_size + 1;
+			return v.end();
 		}
 
 		void swap(std::vector<CharT, Allocator>& v_)
 		{
 			v.swap(v_);
-			pos_in = 0;
 			pos_out = 0;
-			v_size = v.size();
+			set_get(0);
 		}
 
 		template<typename Allocator2>
-		void copy_from(const std::vector<CharT, Allocator>& v_)
+		void copy_from(const std::vector<CharT, Allocator2>& v_)
 		{
-			v.resize(v_.size());
-			std::copy(v_.begin(), v_.end(), v.begin());
-			pos_in = 0;
+			v.assign(v_.begin(), v_.end());
 			pos_out = 0;
-			v_size = v.size();
+			set_get(0);
 		}
 
 		template<typename InputIt>
 		void copy_from(InputIt first, InputIt last)
 		{
 			v.clear();
-			std::copy(first, last, std::back_inserter(v))
-			pos_in = 0;
+			std::copy(first, last, std::back_inserter(v));
 			pos_out = 0;
-			v_size = v.size();
+			set_get(0);
 		}
 
 		template<typename InputIt, typename Size>
 		void copy_from_n(InputIt first, Size size_)
 		{
-			v.resize(size_);
-			std::copy_n(first, size_, v.begin());
-			pos_in = 0;
+			v.clear();
+			v.reserve(size_);
+			std::copy_n(first, size_, std::back_inserter(v));
 			pos_out = 0;
-			v_size = size_;
+			set_get(0);
 		}
 
 		template<typename OutputIt>
 		void copy_to(OutputIt out) const
 		{
-			std::copy_n(v.begin(), v_size, out);
+			std::copy(v.begin(), v.end(), out);
 		}
 
 	private:
+		// size of v is the written size, growth uses the spare capacity so new memory is never zero filled
 		std::vector<CharT, Allocator> v;
-		std::size_t pos_in = 0, pos_out = 0;
-		std::size_t v_size = 0;
+		std::size_t pos_out = 0;
 
-		void update_get_area()
+		// the get area always covers the whole vector, so the read position is gptr()
+		std::size_t pos_in() const
 		{
-			setg(v.data(), v.data() + pos_in, v.data() + v.size());
+			return this->gptr() - this->eback();
 		}
 
-		void update_put_area()
+		void set_get(std::size_t pos)
 		{
-			setp(v.data() + pos_out, v.data() + v.size());
+			setg(v.data(), v.data() + pos, v.data() + v.size());
 		}
 
-		void expand_realloc(size_t least = 0)
+		void update_put_area()
 		{
-			size_t new_size = v.size() * 2;
-			if (new_size == 0)
-			{
-				new_size = 1;
-			}
-			while (new_size < least)
-			{
-				new_size *= 2;
-			}
-			v.resize(new_size);
+			// no put area, so every write goes through xsputn/overflow and updates pos_out and v.size()
+			setp(nullptr, nullptr);
 		}
-		
+
 	protected:
 		using std::basic_streambuf<CharT, Traits>::setg;
 		using std::basic_streambuf<CharT, Traits>::setp;
 
 		virtual basic_vectorbuf<CharT, Traits, Allocator>* setbuf(char_type* s, std::streamsize n) override
 		{
-			v = std::vector(s, s + n);
+			v.assign(s, s + n);
+			pos_out = 0;
+			set_get(0);
 			return this;
 		}
 
@@ -156,14 +182,13 @@ namespace mtar
 			{
 			case std::ios_base::beg:
 				// out of range
-				if (off < 0 || off >= v.size())
+				if (off < 0 || static_cast<std::size_t>(off) > v.size())
 				{
 					return -1;
 				}
 				if ((which & std::ios_base::in) == std::ios_base::in)
 				{
-					pos_in = off;
-					update_get_area();
+					set_get(off);
 				}
 				if ((which & std::ios_base::out) == std::ios_base::out)
 				{
@@ -173,14 +198,13 @@ namespace mtar
 				return off;
 			case std::ios_base::end:
 				// out of range
-				if (v.size() < -off || off > 0)
+				if (off > 0 || static_cast<std::size_t>(-off) > v.size())
 				{
 					return -1;
 				}
 				if ((which & std::ios_base::in) == std::ios_base::in)
 				{
-					pos_in = v.size() + off;
-					update_get_area();
+					set_get(v.size() + off);
 				}
 				if ((which & std::ios_base::out) == std::ios_base::out)
 				{
@@ -197,18 +221,18 @@ namespace mtar
 				if ((which & std::ios_base::in) == std::ios_base::in)
 				{
 					// out of range
-					if (pos_in < -off || pos_in + off > v.size())
+					const std::size_t in = pos_in();
+					if ((off < 0 && in < static_cast<std::size_t>(-off)) || (off > 0 && in + off > v.size()))
 					{
 						return -1;
 					}
-					pos_in += off;
-					update_get_area();
-					return pos_in;
+					set_get(in + off);
+					return in + off;
 				}
 				if ((which & std::ios_base::out) == std::ios_base::out)
 				{
 					// out of range
-					if (pos_out < -off || pos_out + off > v.size())
+					if ((off < 0 && pos_out < static_cast<std::size_t>(-off)) || (off > 0 && pos_out + off > v.size()))
 					{
 						return -1;
 					}
@@ -226,10 +250,14 @@ namespace mtar
 			{
 				return -1;
 			}
+			// out of range
+			if (off_type(pos) < 0 || static_cast<std::size_t>(off_type(pos)) > v.size())
+			{
+				return -1;
+			}
 			if ((which & std::ios_base::in) == std::ios_base::in)
 			{
-				pos_in = pos;
-				update_get_area();
+				set_get(off_type(pos));
 			}
 			if ((which & std::ios_base::out) == std::ios_base::out)
 			{
@@ -241,7 +269,7 @@ namespace mtar
 
 		virtual std::streamsize showmanyc() override
 		{
-			std::streamsize num = v.size() - pos_in;
+			std::streamsize num = v.size() - pos_in();
 			if (num == 0)
 			{
 				return -1;
@@ -249,73 +277,58 @@ namespace mtar
 			return num;
 		}
 
+		// reads are served from the get area, so this is only called at the end
 		virtual int_type underflow() override
 		{
-			if (pos_in == v.size())
-			{
-				return Traits::eof();
-			}
-			return Traits::to_int_type(v[pos_in]); // no increment
-		}
-
-		virtual std::streamsize xsgetn(char_type* s, std::streamsize count) override
-		{
-			if (pos_in == v.size())
+			if (this->gptr() == this->egptr())
 			{
 				return Traits::eof();
 			}
-			const std::streamsize num = std::min(count, std::streamsize(v.size() - pos_in));
-			std::copy_n(v.begin() + pos_in, num, s);
-			pos_in += num;
-			update_get_area();
-			return num;
+			return Traits::to_int_type(*this->gptr());
 		}
 
 		virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override
 		{
-			if (pos_out + count > v.size())
-			{
-				expand_realloc(pos_out + count);
-			}
-			std::copy_n(s, count, v.begin() + pos_out);
+			// overwrite up to the end, then append (vector growth is geometric and doesn't zero fill)
+			const std::size_t in = pos_in();
+			const std::size_t overlap = std::min(std::size_t(count), v.size() - pos_out);
+			std::copy_n(s, overlap, v.begin() + pos_out);
+			v.insert(v.end(), s + overlap, s + count);
 			pos_out += count;
-			if (pos_out > v_size)
-			{
-				v_size = pos_out;
-			}
-			update_put_area();
+			set_get(in);
 			return count;
 		}
 
 		virtual int_type overflow(int_type ch = Traits::eof()) override
 		{
-			if (Traits::eq_int_type(ch, Traits::eof()))
+			if (!Traits::eq_int_type(ch, Traits::eof()))
 			{
-				if (pos_out + 1 > v.size())
+				if (pos_out < v.size())
 				{
-					expand_realloc();
+					v[pos_out] = Traits::to_char_type(ch);
 				}
-				v[pos_out] = ch;
-				pos_out++;
-				if (pos_out > v_size)
+				else
 				{
-					v_size = pos_out;
+					const std::size_t in = pos_in();
+					v.push_back(Traits::to_char_type(ch));
+					set_get(in);
 				}
-				update_put_area();
+				pos_out++;
 			}
 			return Traits::not_eof(ch);
 		}
 
 		virtual int_type pbackfail(int_type ch = Traits::eof()) override
 		{
-			if (Traits::eq_int_type(ch, Traits::eof()))
+			// called at the beginning, or to put back a different character than the one read
+			if (this->gptr() == this->eback())
 			{
-				pos_in--;
-				update_put_area();
+				return Traits::eof();
 			}
-			else
+			this->gbump(-1);
+			if (!Traits::eq_int_type(ch, Traits::eof()))
 			{
-				v[pos_in - 1] = ch;
+				*this->gptr() = Traits::to_char_type(ch);
 			}
 			return Traits::not_eof(ch);
 		}
@@ -327,44 +340,52 @@ namespace mtar
 	private:
 		using base = std::basic_iostream<CharT, Traits>;
 		using vectorbuf = basic_vectorbuf<CharT, Traits, Allocator>;
+		// buffer owned by the stream, unused if an external buffer is given
+		// base only stores the pointer, so it may be passed before own_buf is constructed
+		vectorbuf own_buf;
 		vectorbuf* buf;
 
 	public:
-		// this feels illegal
-		basic_vectorstream(basic_vectorbuf<CharT, Traits, Allocator>& vb) : base(buf = &vb) {}
-		basic_vectorstream() : base(buf = new vectorbuf()) {}
-		basic_vectorstream(const Allocator& alloc) : base(buf = new vectorbuf(alloc)) {}
+		basic_vectorstream(basic_vectorbuf<CharT, Traits, Allocator>& vb) : base(&vb), buf(&vb) {}
+		basic_vectorstream() : base(&own_buf), buf(&own_buf) {}
+		basic_vectorstream(const Allocator& alloc) : base(&own_buf), own_buf(alloc), buf(&own_buf) {}
 		template<typename InputIt>
-		basic_vectorstream(InputIt first, InputIt last, const Allocator& alloc = Allocator()) : base(buf = new vectorbuf(first, last, alloc)) {}
-		basic_vectorstream(const std::vector<CharT, Allocator>& v_) : base(buf = new vectorbuf(v_, alloc)) {}
-		basic_vectorstream(const std::vector<CharT, Allocator>& v_, const Allocator& alloc) : base(buf = new vectorbuf(v_, alloc)) {}
-		basic_vectorstream(std::vector<CharT, Allocator>&& v_) : base(buf = new vectorbuf(std::move(v_))) {}
-		basic_vectorstream(std::vector<CharT, Allocator>&& v_, const Allocator& alloc) : base(buf = new vectorbuf(std::move(v_), alloc)) {}
-		basic_vectorstream(std::initializer_list<CharT> init, const Allocator& alloc = Allocator()) : base(buf = new vectorbuf(init, alloc)) {}
-		~basic_vectorstream()
-		{
-			delete buf;
-		}
+		basic_vectorstream(InputIt first, InputIt last, const Allocator& alloc = Allocator()) : base(&own_buf), own_buf(first, last, alloc), buf(&own_buf) {}
+		basic_vectorstream(const std::vector<CharT, Allocator>& v_) : base(&own_buf), own_buf(v_), buf(&own_buf) {}
+		basic_vectorstream(const std::vector<CharT, Allocator>& v_, const Allocator& alloc) : base(&own_buf), own_buf(v_, alloc), buf(&own_buf) {}
+		basic_vectorstream(std::vector<CharT, Allocator>&& v_) : base(&own_buf), own_buf(std::move(v_)), buf(&own_buf) {}
+		basic_vectorstream(std::vector<CharT, Allocator>&& v_, const Allocator& alloc) : base(&own_buf), own_buf(std::move(v_), alloc), buf(&own_buf) {}
+		basic_vectorstream(std::initializer_list<CharT> init, const Allocator& alloc = Allocator()) : base(&own_buf), own_buf(init, alloc), buf(&own_buf) {}
 
 		std::vector<CharT, Allocator> vec_copy() const
 		{
-			return buf->(v.begin(), v.begin() + size);
+			return buf->vec_copy();
 		}
 
 		// note: this view will no longer be valid after reallocation
 		std::basic_string_view<CharT, Traits> view() const
 		{
-			return buf->(v.begin(), v.begin() + size);
+			return buf->view();
 		}
 
 		std::size_t size() const
 		{
-			return buf->size;
+			return buf->size();
+		}
+
+		std::size_t capacity() const
+		{
+			return buf->capacity();
+		}
+
+		void reserve(std::size_t n)
+		{
+			buf->reserve(n);
 		}
 
 		const CharT& operator[](std::size_t pos) const
 		{
-			return buf->v[pos];
+			return (*buf)[pos];
 		}
 
 		void swap(std::vector<CharT, Allocator>& v)
@@ -373,7 +394,7 @@ namespace mtar
 		}
 
 		template<typename Allocator2>
-		void copy_from(const std::vector<CharT, Allocator>& v)
+		void copy_from(const std::vector<CharT, Allocator2>& v)
 		{
 			buf->copy_from(v);
 		}
@@ -387,7 +408,275 @@ namespace mtar
 		template<typename InputIt, typename Size>
 		void copy_from_n(InputIt first, Size size_)
 		{
-			buf->copy_from(first, size);
+			buf->copy_from_n(first, size_);
+		}
+
+		template<typename OutputIt>
+		void copy_to(OutputIt out) const
+		{
+			buf->copy_to(out);
+		}
+	};
+
+	// segmented buffer, data is stored in fixed size chunks that are never moved or initialized
+	// growing never copies what was already written, the contents can be handed out as spans (e.g. for writev)
+	template<typename CharT, typename Traits = std::char_traits<CharT>, typename Allocator = std::allocator<CharT>>
+	class basic_chunkbuf : public std::basic_streambuf<CharT, Traits>
+	{
+	private:
+		using base = std::basic_streambuf<CharT, Traits>;
+		using alloc_traits = std::allocator_traits<Allocator>;
+
+	public:
+		using char_type = typename base::char_type;
+		using traits_type = typename base::traits_type;
+		using int_type = typename base::int_type;
+		using pos_type = typename base::pos_type;
+		using off_type = typename base::off_type;
+
+		static constexpr std::size_t default_chunk_size = 1 << 20;
+
+		explicit basic_chunkbuf(std::size_t chunk_size_ = default_chunk_size, const Allocator& alloc_ = Allocator()) : alloc(alloc_), chunk_sz(chunk_size_ == 0 ? default_chunk_size : chunk_size_) {}
+		basic_chunkbuf(const basic_chunkbuf&) = delete;
+		basic_chunkbuf& operator=(const basic_chunkbuf&) = delete;
+
+		~basic_chunkbuf()
+		{
+			for (CharT* chunk : chunks)
+			{
+				alloc_traits::deallocate(alloc, chunk, chunk_sz);
+			}
+		}
+
+		std::size_t size() const
+		{
+			return len;
+		}
+
+		std::size_t chunk_size() const
+		{
+			return chunk_sz;
+		}
+
+		std::size_t capacity() const
+		{
+			return chunks.size() * chunk_sz;
+		}
+
+		// allocate chunks for at least n characters
+		void reserve(std::size_t n)
+		{
+			while (capacity() < n)
+			{
+				add_chunk();
+			}
+		}
+
+		// contents in order, one span per chunk
+		// note: spans stay valid until clear() or destruction, writing doesn't move existing data
+		std::vector<std::basic_string_view<CharT, Traits>> spans() const
+		{
+			std::vector<std::basic_string_view<CharT, Traits>> out;
+			for (std::size_t i = 0; i * chunk_sz < len; i++)
+			{
+				out.emplace_back(chunks[i], std::min(chunk_sz, len - i * chunk_sz));
+			}
+			return out;
+		}
+
+		template<typename OutputIt>
+		void copy_to(OutputIt out) const
+		{
+			for (const auto& span : spans())
+			{
+				out = std::copy(span.begin(), span.end(), out);
+			}
+		}
+
+		// drop the contents, allocated chunks are kept for reuse
+		void clear()
+		{
+			len = 0;
+			pos_out = 0;
+			set_get(0);
+		}
+
+	private:
+		Allocator alloc;
+		std::vector<CharT*> chunks;
+		std::size_t chunk_sz;
+		std::size_t len = 0, pos_out = 0;
+		// absolute position of eback(), the get area never spans more than one chunk
+		std::size_t get_base = 0;
+
+		void add_chunk()
+		{
+			chunks.push_back(alloc_traits::allocate(alloc, chunk_sz));
+		}
+
+		std::size_t pos_in() const
+		{
+			return get_base + (this->gptr() - this->eback());
+		}
+
+		void set_get(std::size_t pos)
+		{
+			if (pos >= len)
+			{
+				setg(nullptr, nullptr, nullptr);
+				get_base = pos;
+				return;
+			}
+			const std::size_t index = pos / chunk_sz;
+			get_base = index * chunk_sz;
+			CharT* chunk = chunks[index];
+			setg(chunk, chunk + (pos - get_base), chunk + (std::min(get_base + chunk_sz, len) - get_base));
+		}
+
+		pos_type seek(std::size_t pos, std::ios_base::openmode which)
+		{
+			if ((which & std::ios_base::in) == std::ios_base::in)
+			{
+				set_get(pos);
+			}
+			if ((which & std::ios_base::out) == std::ios_base::out)
+			{
+				pos_out = pos;
+			}
+			return pos_type(off_type(pos));
+		}
+
+	protected:
+		using std::basic_streambuf<CharT, Traits>::setg;
+
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) override
+		{
+			const bool in = (which & std::ios_base::in) == std::ios_base::in;
+			const bool out = (which & std::ios_base::out) == std::ios_base::out;
+			// neither in nor out is set, or both with cur (same as std::basic_stringbuf)
+			if ((!in && !out) || (in && out && dir == std::ios_base::cur))
+			{
+				return -1;
+			}
+			off_type from = 0;
+			if (dir == std::ios_base::end)
+			{
+				from = len;
+			}
+			else if (dir == std::ios_base::cur)
+			{
+				from = in ? pos_in() : pos_out;
+			}
+			// out of range
+			if ((off < 0 && from < -off) || (off > 0 && off > off_type(len) - from))
+			{
+				return -1;
+			}
+			return seek(from + off, which);
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) override
+		{
+			if ((which & std::ios_base::in) != std::ios_base::in && (which & std::ios_base::out) != std::ios_base::out)
+			{
+				return -1;
+			}
+			// out of range
+			if (off_type(pos) < 0 || static_cast<std::size_t>(off_type(pos)) > len)
+			{
+				return -1;
+			}
+			return seek(off_type(pos), which);
+		}
+
+		virtual std::streamsize showmanyc() override
+		{
+			const std::size_t pos = pos_in();
+			if (pos >= len)
+			{
+				return -1;
+			}
+			return len - pos;
+		}
+
+		virtual int_type underflow() override
+		{
+			// move the get area to the chunk at the current position, or extend it after a write
+			set_get(pos_in());
+			if (this->gptr() == this->egptr())
+			{
+				return Traits::eof();
+			}
+			return Traits::to_int_type(*this->gptr());
+		}
+
+		virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override
+		{
+			std::streamsize done = 0;
+			while (done < count)
+			{
+				if (pos_out == capacity())
+				{
+					add_chunk();
+				}
+				const std::size_t offset = pos_out % chunk_sz;
+				const std::size_t num = std::min(chunk_sz - offset, std::size_t(count - done));
+				std::copy_n(s + done, num, chunks[pos_out / chunk_sz] + offset);
+				pos_out += num;
+				done += num;
+			}
+			len = std::max(len, pos_out);
+			return count;
+		}
+
+		virtual int_type overflow(int_type ch = Traits::eof()) override
+		{
+			if (!Traits::eq_int_type(ch, Traits::eof()))
+			{
+				const char_type c = Traits::to_char_type(ch);
+				xsputn(&c, 1);
+			}
+			return Traits::not_eof(ch);
+		}
+	};
+
+	template<typename CharT, typename Traits = std::char_traits<CharT>, typename Allocator = std::allocator<CharT>>
+	class basic_chunkstream : public std::basic_iostream<CharT, Traits>
+	{
+	private:
+		using base = std::basic_iostream<CharT, Traits>;
+		using chunkbuf = basic_chunkbuf<CharT, Traits, Allocator>;
+		// buffer owned by the stream, unused if an external buffer is given
+		chunkbuf own_buf;
+		chunkbuf* buf;
+
+	public:
+		basic_chunkstream(chunkbuf& cb) : base(&cb), buf(&cb) {}
+		explicit basic_chunkstream(std::size_t chunk_size = chunkbuf::default_chunk_size, const Allocator& alloc = Allocator()) : base(&own_buf), own_buf(chunk_size, alloc), buf(&own_buf) {}
+
+		std::size_t size() const
+		{
+			return buf->size();
+		}
+
+		std::size_t chunk_size() const
+		{
+			return buf->chunk_size();
+		}
+
+		std::size_t capacity() const
+		{
+			return buf->capacity();
+		}
+
+		void reserve(std::size_t n)
+		{
+			buf->reserve(n);
+		}
+
+		std::vector<std::basic_string_view<CharT, Traits>> spans() const
+		{
+			return buf->spans();
 		}
 
 		template<typename OutputIt>
@@ -397,5 +686,10 @@ namespace mtar
 		}
 	};
 
+	using vectorbuf = basic_vectorbuf<char>;
 	using vectorstream = basic_vectorstream<char>;
+	using chunkbuf = basic_chunkbuf<char>;
+	using chunkstream = basic_chunkstream<char>;
 }
+
+#endif